@@ -3,10 +3,13 @@
 #include <cassert>
 #include <iterator>
 #include <tuple>
+#include <utility>
 #include <type_traits>
 #include <stdexcept>
 #include <string>
 #include <memory>
+#include <new>
+#include <cstddef>
 #include <vector>
 #include <set>
 #include <algorithm>
@@ -15,6 +18,99 @@
 #include <list>
 #include <unordered_map>
 #include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <limits>
+
+//query arenas derive from std::pmr::memory_resource when the standard library has it
+#if defined(__has_include)
+#if __has_include(<memory_resource>) && (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#include <memory_resource>
+#define PL_LINQ_HAS_PMR 1
+#endif
+#endif
+
+//line sources yield std::string_view when the standard library has it
+#if defined(__has_include)
+#if __has_include(<string_view>) && (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#include <string_view>
+#define PL_LINQ_HAS_STRING_VIEW 1
+#endif
+#if __has_include(<charconv>) && (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#include <charconv>
+#endif
+#endif
+
+//from_mmap maps files with the native API, define PL_LINQ_NO_MMAP to leave it out
+#if !defined(PL_LINQ_NO_MMAP)
+#if defined(_WIN32)
+#define PL_LINQ_MMAP_WIN32 1
+#ifndef NOMINMAX
+#define NOMINMAX
+#define PL_LINQ_UNDEF_NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#define PL_LINQ_UNDEF_WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#ifdef PL_LINQ_UNDEF_NOMINMAX
+#undef NOMINMAX
+#undef PL_LINQ_UNDEF_NOMINMAX
+#endif
+#ifdef PL_LINQ_UNDEF_WIN32_LEAN_AND_MEAN
+#undef WIN32_LEAN_AND_MEAN
+#undef PL_LINQ_UNDEF_WIN32_LEAN_AND_MEAN
+#endif
+#elif defined(__unix__) || defined(__APPLE__)
+#define PL_LINQ_MMAP_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
+//linq collections are usable as C++20 ranges
+#if defined(__has_include)
+#if __has_include(<ranges>) && (__cplusplus > 201703L || (defined(_MSVC_LANG) && _MSVC_LANG > 201703L))
+#include <ranges>
+#endif
+#endif
+
+//generator and from_generator need C++20 coroutines
+#if defined(__has_include)
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define PL_LINQ_HAS_COROUTINES 1
+#endif
+#endif
+
+//reductions over contiguous arithmetic sources use SSE2/AVX2/AVX-512 kernels picked at runtime
+#if !defined(PL_LINQ_NO_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define PL_LINQ_SIMD_X86 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define PL_LINQ_TARGET(isa)
+#if _MSC_VER >= 1911
+#define PL_LINQ_SIMD_AVX512 1
+#endif
+#else
+#include <immintrin.h>
+#define PL_LINQ_TARGET(isa) __attribute__((target(isa)))
+#define PL_LINQ_SIMD_AVX512 1
+#endif
+#endif
 
 namespace pl
 {
@@ -48,6 +144,20 @@ public:
     }
 };
 
+class index_out_of_range : public linq_exception
+{
+public:
+    explicit index_out_of_range(const std::string& _Message)
+        : linq_exception(_Message.c_str())
+    {
+    }
+
+    explicit index_out_of_range(const char* _Message)
+        : linq_exception(_Message)
+    {
+    }
+};
+
 class element_not_unique : public linq_exception
 {
 public:
@@ -62,6 +172,34 @@ public:
     }
 };
 
+class file_not_readable : public linq_exception
+{
+public:
+    explicit file_not_readable(const std::string& _Message)
+        : linq_exception(_Message.c_str())
+    {
+    }
+
+    explicit file_not_readable(const char* _Message)
+        : linq_exception(_Message)
+    {
+    }
+};
+
+class csv_format_error : public linq_exception
+{
+public:
+    explicit csv_format_error(const std::string& _Message)
+        : linq_exception(_Message.c_str())
+    {
+    }
+
+    explicit csv_format_error(const char* _Message)
+        : linq_exception(_Message)
+    {
+    }
+};
+
 template <class T>
 struct memfunc_traits;
 
@@ -118,1537 +256,6726 @@ struct callable_traits<TRet(TClass::*)(TArgs ...) const> : memfunc_traits<TRet(T
 template <typename TIterator>
 using deref_iter_t = std::decay_t<decltype(*(std::declval<TIterator>()))>;
 
-template <class TValue>
-class linq_iterator_traits
+template <typename TIterator>
+using deref_ref_t = decltype(*(std::declval<const TIterator&>()));
+
+//keeps the reference when both sides yield the same one, otherwise falls back to a value
+template <class TReference1, class TReference2>
+using common_ref_t = std::conditional_t<std::is_same<TReference1, TReference2>::value,
+                                        TReference1,
+                                        std::decay_t<TReference1>>;
+
+template <class TIterator, class TSink, class = void>
+struct has_push_member : std::false_type
 {
-public:
-    using value_type = TValue;
-    using pointer = value_type*;
-    using reference = value_type&;
-    using difference_type = std::ptrdiff_t;
-    using iterator_category = std::forward_iterator_tag;
 };
 
-template <class... iters>
-class iterator_common_impl;
-
-template <class TIterator, class TValue>
-class iterator_common_impl<TIterator, TValue> : public linq_iterator_traits<TValue>
+template <class TIterator, class TSink>
+struct has_push_member<TIterator, TSink, decltype(void(std::declval<TIterator&>().push(std::declval<const TIterator&>(),
+                                                                                       std::declval<TSink&>())))>
+    : std::true_type
 {
-protected:
-    using self = iterator_common_impl<TIterator, TValue>;
-    using traits = linq_iterator_traits<TValue>;
+};
 
-    TIterator _iter;
+template <class TIterator, class TSink>
+bool linq_push_impl(TIterator& iter, const TIterator& end, TSink& sink, std::true_type)
+{
+    return iter.push(end, sink);
+}
 
-    explicit iterator_common_impl(const TIterator& iter)
-        : _iter(iter)
+template <class TIterator, class TSink>
+bool linq_push_impl(TIterator& iter, const TIterator& end, TSink& sink, std::false_type)
+{
+    for (; iter != end; ++iter)
     {
+        if (!sink(*iter))
+        {
+            return false;
+        }
     }
+    return true;
+}
+
+/*
+ * feeds every element in [iter, end) to sink, stopping as soon as sink returns false.
+ * iterators providing a push member (e.g. any_iterator) get to drive the loop themselves.
+ * returns false if sink stopped the iteration, iter is unspecified afterwards.
+ */
+template <class TIterator, class TSink>
+bool linq_push(TIterator& iter, const TIterator& end, TSink&& sink)
+{
+    return linq_push_impl(iter, end, sink, has_push_member<TIterator, std::remove_reference_t<TSink>>{});
+}
 
+/*
+ * the hash tables, group vectors and shared blocks built by materializing operators are drawn from
+ * the memory resource installed for the current thread, or from the global heap when there is none.
+ * every structure keeps the resource it was created with, so results must not outlive it.
+ */
+#ifdef PL_LINQ_HAS_PMR
+using memory_resource = std::pmr::memory_resource;
+#else
+//the subset of std::pmr::memory_resource used here
+class memory_resource
+{
 public:
-    using value_type = typename traits::value_type;
-    using pointer = typename traits::pointer;
-    using reference = typename traits::reference;
-    using difference_type = typename traits::difference_type;
-    using iterator_category = typename traits::iterator_category;
+    virtual ~memory_resource() = default;
 
-    self& operator++()
+    void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
     {
-        ++_iter;
-        return *this;
+        return do_allocate(bytes, alignment);
     }
 
-    value_type operator*() const
+    void deallocate(void* p, std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
     {
-        return *_iter;
+        do_deallocate(p, bytes, alignment);
     }
 
-    bool operator==(const self& other) const
+    bool is_equal(const memory_resource& other) const noexcept
     {
-        return _iter == other._iter;
+        return do_is_equal(other);
     }
 
-    bool operator!=(const self& other) const
-    {
-        return _iter != other._iter;
-    }
+private:
+    virtual void* do_allocate(std::size_t bytes, std::size_t alignment) = 0;
+    virtual void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) = 0;
+    virtual bool do_is_equal(const memory_resource& other) const noexcept = 0;
 };
+#endif
 
-template <class TIterator>
-class iterator_common_impl<TIterator> : public iterator_common_impl<TIterator, deref_iter_t<TIterator>>
+inline memory_resource*& installed_memory_resource()
 {
-protected:
-    using base = iterator_common_impl<TIterator, deref_iter_t<TIterator>>;
-    using traits = typename base::traits;
-    using value_type = typename traits::value_type;
-    using pointer = typename traits::pointer;
-    using reference = typename traits::reference;
-    using difference_type = typename traits::difference_type;
-    using iterator_category = typename traits::iterator_category;
-
-    explicit iterator_common_impl(const TIterator& iter)
-        : iterator_common_impl<TIterator, deref_iter_t<TIterator>>(iter)
-    {
-    }
+    static thread_local memory_resource* resource = nullptr;
+    return resource;
+}
 
-};
+//null when operators allocate from the global heap
+inline memory_resource* current_memory_resource()
+{
+    return installed_memory_resource();
+}
 
-template <class TIterator, class TFunction>
-class select_iterator : public iterator_common_impl<TIterator, decltype(std::declval<TFunction>()(std::declval<deref_iter_t<TIterator>>()))>
+//installs a memory resource for the queries built and run on this thread until the scope ends
+class memory_scope
 {
 private:
-    using base = iterator_common_impl<TIterator, decltype(std::declval<TFunction>()(std::declval<deref_iter_t<TIterator>>()))>;
-    using self = select_iterator<TIterator, TFunction>;
-    using return_type = decltype(std::declval<TFunction>()(std::declval<deref_iter_t<TIterator>>()));
-    
+    memory_resource* _previous;
 
-    TFunction _func;
 public:
-
-    using value_type = typename base::value_type;
-    using pointer = typename base::pointer;
-    using reference = typename base::reference;
-    using difference_type = typename base::difference_type;
-    using iterator_category = typename base::iterator_category;
-
-    select_iterator(const TIterator& iter, const TFunction& pred)
-        : base(iter)
-        , _func(pred)
+    explicit memory_scope(memory_resource& resource)
+        : _previous(installed_memory_resource())
     {
+        installed_memory_resource() = &resource;
     }
 
-    auto operator*() const -> return_type
+    memory_scope(const memory_scope&) = delete;
+    memory_scope& operator=(const memory_scope&) = delete;
+
+    ~memory_scope()
     {
-        return _func(*base::_iter);
+        installed_memory_resource() = _previous;
     }
 };
 
-template <class TIterator, class TFunction>
-class where_iterator : public iterator_common_impl<TIterator>
+template <class TFunction>
+auto with_memory(memory_resource& resource, const TFunction& query)
 {
-private:
-    using base = iterator_common_impl<TIterator>;
-public:
-    using self = where_iterator<TIterator, TFunction>;
+    memory_scope scope(resource);
+    return query();
+}
 
-    using value_type = typename base::value_type;
-    using pointer = typename base::pointer;
-    using reference = typename base::reference;
-    using difference_type = typename base::difference_type;
-    using iterator_category = typename base::iterator_category;
+/*
+ * a monotonic arena for one query or one request: deallocation is a no-op,
+ * release() or the destructor frees every block at once.
+ * Like std::pmr::monotonic_buffer_resource it must not be shared between threads.
+ */
+class query_arena : public memory_resource
+{
 private:
-    TIterator _end;
-    TFunction _func;
+    struct block
+    {
+        block* next;
+        std::size_t size;
+    };
 
-    void check_move_iterator()
+    std::size_t _initial_size;
+    std::size_t _next_size;
+    block* _blocks;
+    char* _current;
+    char* _limit;
+    std::size_t _used;
+
+    static char* align_up(char* p, std::size_t alignment)
+    {
+        auto address = reinterpret_cast<std::uintptr_t>(p);
+        return p + ((alignment - address % alignment) % alignment);
+    }
+
+    void grow(std::size_t bytes, std::size_t alignment)
+    {
+        auto size = std::max(_next_size, bytes + alignment);
+        auto b = static_cast<block*>(::operator new(sizeof(block) + size));
+        b->next = _blocks;
+        b->size = size;
+        _blocks = b;
+        _current = reinterpret_cast<char*>(b + 1);
+        _limit = _current + size;
+        _next_size = size * 2;
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
     {
-        while (base::_iter != _end && !_func(*base::_iter))
+        auto p = _current ? align_up(_current, alignment) : nullptr;
+        if (!p || bytes > static_cast<std::size_t>(_limit - p))
         {
-            ++base::_iter;
+            grow(bytes, alignment);
+            p = align_up(_current, alignment);
         }
+        _current = p + bytes;
+        _used += bytes;
+        return p;
     }
 
-public:
-    where_iterator(const TIterator& begin, const TIterator& end, const TFunction& func)
-        : base(begin)
-        , _end(end)
-        , _func(func)
+    void do_deallocate(void*, std::size_t, std::size_t) override
     {
-        check_move_iterator();
     }
 
+    bool do_is_equal(const memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
 
-    self& operator++()
+public:
+    explicit query_arena(std::size_t initial_size = 4096)
+        : _initial_size(std::max<std::size_t>(initial_size, 64))
+        , _next_size(_initial_size)
+        , _blocks(nullptr)
+        , _current(nullptr)
+        , _limit(nullptr)
+        , _used(0)
     {
-        ++base::_iter;
-        check_move_iterator();
+    }
 
-        return *this;
+    query_arena(const query_arena&) = delete;
+    query_arena& operator=(const query_arena&) = delete;
+
+    ~query_arena()
+    {
+        release();
     }
-};
 
-template <class TIterator>
-class skip_iterator : public iterator_common_impl<TIterator>
-{
-private:
-    using base = iterator_common_impl<TIterator>;
-    using self = skip_iterator<TIterator>;
-public:
-    using value_type = typename base::value_type;
-    using pointer = typename base::pointer;
-    using reference = typename base::reference;
-    using difference_type = typename base::difference_type;
-    using iterator_category = typename base::iterator_category;
-private:
-    TIterator _end;
-public:
-    skip_iterator(const TIterator& iter, const TIterator& end, std::size_t count)
-        : base(iter)
-        , _end(end)
+    void release()
     {
-        assert(count >= 0);
-        for (std::size_t i = 0; i != count && base::_iter != _end; i++ , ++base::_iter)
+        while (_blocks)
         {
-            //nothing
+            auto next = _blocks->next;
+            ::operator delete(_blocks);
+            _blocks = next;
         }
+        _next_size = _initial_size;
+        _current = nullptr;
+        _limit = nullptr;
+        _used = 0;
+    }
+
+    //bytes handed out since construction or the last release
+    std::size_t used() const
+    {
+        return _used;
     }
 };
 
-template <class TIterator, class TFunction>
-class skip_while_iterator : public iterator_common_impl<TIterator>
+//draws from the memory resource that was current when the allocator was created
+template <class T>
+class arena_allocator
 {
 private:
-    using base = iterator_common_impl<TIterator>;
-    using self = skip_while_iterator<TIterator, TFunction>;
+    memory_resource* _resource;
 
-    TIterator _end;
-    TFunction _func;
 public:
+    using value_type = T;
 
-    using value_type = typename base::value_type;
-    using pointer = typename base::pointer;
-    using reference = typename base::reference;
-    using difference_type = typename base::difference_type;
-    using iterator_category = typename base::iterator_category;
-
-    skip_while_iterator(const TIterator& iter, const TIterator& end, const TFunction& func)
-        : base(iter)
-        , _end(end)
-        , _func(func)
+    arena_allocator() noexcept
+        : _resource(current_memory_resource())
     {
-        while (base::_iter != end && func(*base::_iter))
-        {
-            ++base::_iter;
-        }
     }
-};
 
-template <class TIterator>
-class take_iterator : public iterator_common_impl<TIterator>
-{
-    using base = iterator_common_impl<TIterator>;
-    using self = take_iterator<TIterator>;
-public:
-    using value_type = typename base::value_type;
-    using pointer = typename base::pointer;
-    using reference = typename base::reference;
-    using difference_type = typename base::difference_type;
-    using iterator_category = typename base::iterator_category;
+    template <class U>
+    arena_allocator(const arena_allocator<U>& other) noexcept
+        : _resource(other.resource())
+    {
+    }
 
-private:
-    TIterator _end;
-    std::size_t _current;
-    std::size_t _count;
-public:
-    take_iterator(const TIterator& iter, const TIterator& end, std::size_t count)
-        : iterator_common_impl<TIterator>(iter)
-        , _end(end)
-        , _current(0)
-        , _count(count)
+    memory_resource* resource() const noexcept
     {
-        assert(_count >= 0);
-        if (_count == 0)
-        {
-            base::_iter = _end;
-        }
+        return _resource;
     }
 
-    self& operator++()
+    T* allocate(std::size_t n)
     {
-        if (++_current == _count)
+        if (!_resource)
         {
-            base::_iter = _end;
+            return std::allocator<T>().allocate(n);
         }
-        else
+        if (n > static_cast<std::size_t>(-1) / sizeof(T))
         {
-            ++base::_iter;
+            throw std::bad_alloc();
         }
-        return *this;
+        return static_cast<T*>(_resource->allocate(n * sizeof(T), alignof(T)));
     }
-};
-
-template <class TIterator, class TFunction>
-class take_while_iterator : public iterator_common_impl<TIterator>
-{
-    using base = iterator_common_impl<TIterator>;
-    using self = take_while_iterator<TIterator, TFunction>;
-public:
-    using value_type = typename base::value_type;
-    using pointer = typename base::pointer;
-    using reference = typename base::reference;
-    using difference_type = typename base::difference_type;
-    using iterator_category = typename base::iterator_category;
 
-private:
-    TIterator _end;
-    TFunction _func;
-public:
-    take_while_iterator(const TIterator& begin, const TIterator& end, const TFunction& func)
-        : iterator_common_impl<TIterator>(begin)
-        , _end(end)
-        , _func(func)
+    void deallocate(T* p, std::size_t n) noexcept
     {
-        if (base::_iter != _end && !_func(*base::_iter))
+        if (!_resource)
         {
-            base::_iter = end;
+            std::allocator<T>().deallocate(p, n);
+            return;
         }
+        _resource->deallocate(p, n * sizeof(T), alignof(T));
     }
 
-    self& operator++()
+    template <class U>
+    bool operator==(const arena_allocator<U>& other) const noexcept
     {
-        if (!_func(*++base::_iter))
-        {
-            base::_iter = _end;
-        }
-        return *this;
+        return _resource == other.resource();
+    }
+
+    template <class U>
+    bool operator!=(const arena_allocator<U>& other) const noexcept
+    {
+        return _resource != other.resource();
     }
 };
 
-template <class TIterator1, class TIterator2, class TValue>
-class iterator_common_impl<TIterator1, TIterator2, TValue> : public linq_iterator_traits<TValue>
+template <class T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+
+template <class TKey, class TValue, class THash = std::hash<TKey>, class TEqual = std::equal_to<TKey>>
+using arena_unordered_map = std::unordered_map<TKey, TValue, THash, TEqual, arena_allocator<std::pair<const TKey, TValue>>>;
+
+template <class T, class... TArgs>
+std::shared_ptr<T> make_arena_shared(TArgs&&... args)
+{
+    return std::allocate_shared<T>(arena_allocator<T>(), std::forward<TArgs>(args)...);
+}
+
+//small trivially copyable functions are copied into every iterator, anything else is stored once and shared
+template <class TFunction>
+using stores_inline = std::integral_constant<bool, sizeof(TFunction) <= 64 && std::is_trivially_copyable<TFunction>::value>;
+
+/*
+ * stores a function object inside an iterator and keeps the iterator copy-assignable,
+ * lambdas have a deleted copy assignment operator
+ */
+template <class TFunction, bool Shared = !stores_inline<TFunction>::value>
+class function_holder
 {
 private:
-    using self = iterator_common_impl<TIterator1, TIterator2, TValue>;
+    using self = function_holder<TFunction>;
 
-protected:
-    using traits = linq_iterator_traits<TValue>;
-    using value_type = typename traits::value_type;
-    using pointer = typename traits::pointer;
-    using reference = typename traits::reference;
-    using difference_type = typename traits::difference_type;
-    using iterator_category = typename traits::iterator_category;
-
-    TIterator1 _iter1;
-    TIterator2 _iter2;
+    std::aligned_storage_t<sizeof(TFunction), alignof(TFunction)> _storage;
 
-    iterator_common_impl(TIterator1 iter1, TIterator2 iter2)
-        : _iter1(iter1)
-        , _iter2(iter2)
+    void assign(const self& other, std::true_type)
     {
+        get() = other.get();
     }
 
-public:
-    self& operator++()
+    void assign(const self& other, std::false_type) noexcept
     {
-        return *this;
+        get().~TFunction();
+        ::new(&_storage) TFunction(other.get());
     }
 
-    value_type operator*()
+public:
+    //only iterators that are assigned to before use are default constructed
+    function_holder()
+        : _storage()
     {
-        return value_type{};
     }
 
-    bool operator==(const self& other) const
+    explicit function_holder(const TFunction& func)
     {
-        return _iter1 == other._iter1 && _iter2 == other._iter2;
+        ::new(&_storage) TFunction(func);
     }
 
-    bool operator!=(const self& other) const
+    explicit function_holder(TFunction&& func)
     {
-        return !((*this) == other);
+        ::new(&_storage) TFunction(std::move(func));
     }
-};
 
-template <class TIterator1, class TIterator2>
-class concat_iterator : public iterator_common_impl<TIterator1, TIterator2, deref_iter_t<TIterator1>>
-{
-private:
-    using self = concat_iterator<TIterator1, TIterator2>;
-    using base = iterator_common_impl<TIterator1, TIterator2, deref_iter_t<TIterator1>>;
-public:
-    using value_type = typename base::value_type;
-    using pointer = typename base::pointer;
-    using reference = typename base::reference;
-    using difference_type = typename base::difference_type;
-    using iterator_category = typename base::iterator_category;
-private:
-    TIterator1 _end1;
-    TIterator2 _end2;
-public:
-    concat_iterator(const TIterator1& iter1, const TIterator1& end1, const TIterator2& iter2, const TIterator2& end2)
-        : base(iter1, iter2)
-        , _end1(end1)
-        , _end2(end2)
+    function_holder(const self& other)
     {
+        ::new(&_storage) TFunction(other.get());
     }
 
-    self& operator++()
+    self& operator=(const self& other)
     {
-        if (base::_iter1 != _end1)
+        if (this != &other)
         {
-            ++base::_iter1;
-        }
-        else
-        {
-            ++base::_iter2;
+            assign(other, std::is_copy_assignable<TFunction>{});
         }
         return *this;
     }
 
-    value_type operator*() const
+    ~function_holder()
     {
-        if (base::_iter1 != _end1)
-        {
-            return *base::_iter1;
-        }
-        return *base::_iter2;
+        get().~TFunction();
     }
-};
-
-template <class TIterator1, class TIterator2>
-class zip_iterator : public iterator_common_impl<TIterator1,
-                                                 TIterator2,
-                                                 std::pair<deref_iter_t<TIterator1>,
-                                                           deref_iter_t<TIterator2>>>
-{
-private:
-    using self = zip_iterator<TIterator1, TIterator2>;
-    using base = iterator_common_impl<TIterator1,
-                                      TIterator2,
-                                      std::pair<deref_iter_t<TIterator1>,
-                                                deref_iter_t<TIterator2>>>;
 
-    TIterator1 _end1;
-    TIterator2 _end2;
-public:
-    using value_type = typename base::value_type;
-    using pointer = typename base::pointer;
-    using reference = typename base::reference;
-    using difference_type = typename base::difference_type;
-    using iterator_category = typename base::iterator_category;
-    zip_iterator(const TIterator1& begin1, const TIterator1& end1, const TIterator2& begin2, const TIterator2& end2)
-        : base(begin1, begin2)
-        , _end1(end1)
-        , _end2(end2)
+    TFunction& get()
     {
+        return *reinterpret_cast<TFunction*>(&_storage);
     }
 
-    self& operator++()
+    const TFunction& get() const
     {
-        if (base::_iter1 != _end1 && base::_iter2 != _end2)
-        {
-            ++base::_iter1;
-            ++base::_iter2;
-        }
-        return *this;
+        return *reinterpret_cast<const TFunction*>(&_storage);
     }
 
-    value_type operator*() const
+    template <class... TArgs>
+    decltype(auto) operator()(TArgs&&... args) const
     {
-        return value_type{*base::_iter1, *base::_iter2};
+        return get()(std::forward<TArgs>(args)...);
     }
 };
 
-template <class TContainer>
-class boxed_container_iterator : public iterator_common_impl<decltype(std::begin(std::declval<TContainer>()))>
+//copies of the iterators of a stage, and of the queries built on it, share one instance of the function
+template <class TFunction>
+class function_holder<TFunction, true>
 {
 private:
-    using self = boxed_container_iterator<TContainer>;
-    using base = iterator_common_impl<decltype(std::begin(std::declval<TContainer>()))>;
-public:
-    using iterator_type = decltype(std::begin(std::declval<TContainer>()));
-
-    using value_type = typename base::value_type;
-    using pointer = typename base::pointer;
-    using reference = typename base::reference;
-    using difference_type = typename base::difference_type;
-    using iterator_category = typename base::iterator_category;
-
-    std::shared_ptr<TContainer> _container;
-
-    boxed_container_iterator(const std::shared_ptr<TContainer>& container, const iterator_type& iterator)
-        : base(iterator)
-        , _container(container)
-    {
-    }
-};
+    std::shared_ptr<const TFunction> _func;
 
-template <class T>
-class empty_iterator : public linq_iterator_traits<T>
-{
-private:
-    using self = empty_iterator<T>;
 public:
+    function_holder() = default;
 
-    using traits = linq_iterator_traits<T>;
-    using value_type = typename traits::value_type;
-    using pointer = typename traits::pointer;
-    using reference = typename traits::reference;
-    using difference_type = typename traits::difference_type;
-    using iterator_category = typename traits::iterator_category;
-
-    self& operator++()
+    explicit function_holder(const TFunction& func)
+        : _func(make_arena_shared<TFunction>(func))
     {
-        return *this;
     }
 
-    [[noreturn]]
-
-    value_type operator*() const
+    explicit function_holder(TFunction&& func)
+        : _func(make_arena_shared<TFunction>(std::move(func)))
     {
-        throw collection_empty("collection is empty");
     }
 
-    bool operator==(const self&) const
+    const TFunction& get() const
     {
-        return true;
+        return *_func;
     }
 
-    bool operator!=(const self&) const
+    template <class... TArgs>
+    decltype(auto) operator()(TArgs&&... args) const
     {
-        return false;
+        return (*_func)(std::forward<TArgs>(args)...);
     }
 };
 
+template <class TCategory1, class TCategory2>
+using weaker_category_t = std::conditional_t<std::is_base_of<TCategory1, TCategory2>::value, TCategory1, TCategory2>;
 
-template <class TValue>
-class any_iterator : public linq_iterator_traits<TValue>
-{
-private:
-    class any_base
-    {
-        using self = any_base;
-    public:
-        using value_type = TValue;
-        virtual ~any_base() = default;
-        virtual self* operator++() = 0;
-        virtual value_type operator*() const = 0;
-        virtual bool operator==(const self& other) const = 0;
-        virtual bool operator!=(const self& other) const = 0;
-    };
-
-    template <class TIterator>
-    class any_content : public any_base
-    {
-        using self = any_content<TIterator>;
-        using base = any_base;
-        TIterator _iter;
-    public:
-        using value_type = typename base::value_type;
-
-        explicit any_content(const TIterator& iter)
-            : _iter(iter)
-        {
-        }
-
-        self* operator++() override
-        {
-            ++_iter;
-            return this;
-        }
+//linq iterators are at most random access, even over contiguous sources
+template <class TIterator>
+using iterator_category_t = weaker_category_t<std::random_access_iterator_tag,
+                                              typename std::iterator_traits<TIterator>::iterator_category>;
 
-        value_type operator*() const override
-        {
-            return *_iter;
-        }
+template <class TIterator>
+using is_random_access = std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<TIterator>::iterator_category>;
 
-        bool operator==(const base& other) const override
-        {
-            auto real = dynamic_cast<const self*>(&other);
-            return real && _iter == real->_iter;
-        }
+template <class TIterator>
+using is_bidirectional = std::is_base_of<std::bidirectional_iterator_tag, typename std::iterator_traits<TIterator>::iterator_category>;
 
-        bool operator!=(const base& other) const override
-        {
-            return !((*this) == other);
-        }
-    };
+//base of every iterator of this library
+struct linq_iterator_tag
+{
+};
 
-    using self = any_iterator<TValue>;
+template <class TIterator>
+using is_linq_iterator = std::is_base_of<linq_iterator_tag, TIterator>;
 
-    std::shared_ptr<any_base> _iter;
+template <class TReference, class TCategory = std::forward_iterator_tag>
+class linq_iterator_traits : public linq_iterator_tag
+{
 public:
+    using value_type = std::remove_cv_t<std::remove_reference_t<TReference>>;
+    using pointer = std::add_pointer_t<std::remove_reference_t<TReference>>;
+    using reference = TReference;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = TCategory;
+};
 
-    using traits = linq_iterator_traits<TValue>;
-    using value_type = typename traits::value_type;
-    using pointer = typename traits::pointer;
-    using reference = typename traits::reference;
-    using difference_type = typename traits::difference_type;
-    using iterator_category = typename traits::iterator_category;
+template <class TIterator>
+std::size_t advance_bounded(TIterator& iter, const TIterator& end, std::size_t count, std::true_type)
+{
+    auto n = std::min(count, static_cast<std::size_t>(end - iter));
+    iter += static_cast<typename std::iterator_traits<TIterator>::difference_type>(n);
+    return n;
+}
 
-    template <class TIterator>
-    any_iterator(const TIterator& iter)
-        : _iter(std::make_shared<any_content<TIterator>>(iter))
+template <class TIterator>
+std::size_t advance_bounded(TIterator& iter, const TIterator& end, std::size_t count, std::false_type)
+{
+    std::size_t n = 0;
+    for (; n != count && iter != end; n++, ++iter)
     {
+        //nothing
     }
+    return n;
+}
 
-    self& operator++()
-    {
-        ++(*_iter);
-        return *this;
-    }
+//advances iter by at most count elements without passing end, in one jump for random access iterators
+template <class TIterator>
+std::size_t advance_bounded(TIterator& iter, const TIterator& end, std::size_t count)
+{
+    return advance_bounded(iter, end, count, is_random_access<TIterator>{});
+}
 
-    value_type operator*() const
-    {
-        return **_iter;
-    }
+//postfix operators of every linq iterator, C++20 iterator concepts require them
+template <class TIterator, std::enable_if_t<is_linq_iterator<TIterator>::value>* = nullptr>
+TIterator operator++(TIterator& iter, int)
+{
+    TIterator old = iter;
+    ++iter;
+    return old;
+}
 
-    bool operator==(const self& other) const
-    {
-        return (*_iter) == (*other._iter);
-    }
+template <class TIterator, std::enable_if_t<is_linq_iterator<TIterator>::value>* = nullptr>
+TIterator operator--(TIterator& iter, int)
+{
+    TIterator old = iter;
+    --iter;
+    return old;
+}
 
-    bool operator!=(const self& other) const
-    {
-        return !((*this) == other);
-    }
+template <class TIterator, class = void>
+struct sentinel_of
+{
+    using type = TIterator;
 };
 
 template <class TIterator>
-class linq_collection;
+struct sentinel_of<TIterator, decltype(void(std::declval<typename TIterator::sentinel>()))>
+{
+    using type = typename TIterator::sentinel;
+};
 
-template <class T>
-class linq;
+/*
+ * a stage that has to find the end of its source keeps the end of the innermost source,
+ * not a second copy of the whole source iterator, so iterators grow linearly with the length of the pipeline
+ */
+template <class TIterator>
+using sentinel_t = typename sentinel_of<TIterator>::type;
 
-template <class TContainer>
-auto from(const TContainer& cont) -> linq_collection<decltype(std::cbegin(cont))>;
+template <class TIterator>
+using has_sentinel = std::integral_constant<bool, !std::is_same<sentinel_t<TIterator>, TIterator>::value>;
 
 template <class TIterator>
-auto from(const TIterator& a, const TIterator& b) -> linq_collection<TIterator>;
+sentinel_t<TIterator> linq_sentinel(const TIterator& end, std::true_type)
+{
+    return end.end_sentinel();
+}
 
-template <class T>
-linq<T> from_values(const std::initializer_list<T>& cont)
+template <class TIterator>
+const TIterator& linq_sentinel(const TIterator& end, std::false_type)
 {
-    using cont_type = std::vector<T>;
-    auto xs = std::make_shared<cont_type>(cont);
-    return linq_collection<boxed_container_iterator<cont_type>>(
-        boxed_container_iterator<cont_type>(xs, xs->begin()),
-        boxed_container_iterator<cont_type>(xs, xs->end())
-    );
+    return end;
 }
 
-template <class TContainer/*, std::enable_if_t<!std::is_same<
-              std::decay_t<TContainer>,
-              std::initializer_list<deref_iter_t<decltype(std::begin(std::declval<TContainer>()))>>>::value>* = nullptr*/>
-auto from_values(const TContainer& cont) -> linq<deref_iter_t<decltype(std::begin(std::declval<TContainer>()))>>
+//the sentinel an end iterator stands for
+template <class TIterator>
+sentinel_t<TIterator> linq_sentinel(const TIterator& end)
 {
-    auto xs = std::make_shared<TContainer>(cont);
-    using iter_type = boxed_container_iterator<TContainer>;
-    return linq_collection<iter_type>(
-        iter_type(xs, std::begin(*xs)),
-        iter_type(xs, std::end(*xs))
-    );
+    return linq_sentinel(end, has_sentinel<TIterator>{});
 }
 
-template <class TContainer/*, std::enable_if_t<!std::is_same<
-              std::decay_t<TContainer>,
-              std::initializer_list<deref_iter_t<decltype(std::begin(std::declval<TContainer>()))>>>::value>* = nullptr*/>
-auto from_values(TContainer&& cont)
--> linq<deref_iter_t<decltype(std::begin(std::declval<TContainer>()))>>
+template <class TIterator>
+bool linq_at_end(const TIterator& iter, const sentinel_t<TIterator>& end, std::true_type)
 {
-    auto xs = std::make_shared<TContainer>(std::move(cont));
-    using iter_type = boxed_container_iterator<TContainer>;
-    return linq_collection<iter_type>(
-        iter_type(xs, std::begin(*xs)),
-        iter_type(xs, std::end(*xs))
-    );
+    return iter.at_end(end);
 }
 
-template <class T>
-linq<T> from_value(const T& value)
+template <class TIterator>
+bool linq_at_end(const TIterator& iter, const sentinel_t<TIterator>& end, std::false_type)
 {
-    return from_values({value});
+    return iter == end;
 }
 
-template <class T>
-linq<T> from_empty()
+template <class TIterator>
+bool linq_at_end(const TIterator& iter, const sentinel_t<TIterator>& end)
 {
-    using iter_type = empty_iterator<T>;
-    return linq_collection<iter_type>{
-        iter_type{},
-        iter_type{}
-    };
+    return linq_at_end(iter, end, has_sentinel<TIterator>{});
 }
 
 template <class TIterator>
-class linq_collection
+auto linq_distance_to_end(const TIterator& iter, const sentinel_t<TIterator>& end, std::true_type)
+{
+    return iter.distance_to_end(end);
+}
+
+template <class TIterator>
+auto linq_distance_to_end(const TIterator& iter, const sentinel_t<TIterator>& end, std::false_type)
+{
+    return end - iter;
+}
+
+//number of elements left before a sentinel, random access iterators only
+template <class TIterator>
+auto linq_distance_to_end(const TIterator& iter, const sentinel_t<TIterator>& end)
+{
+    return linq_distance_to_end(iter, end, has_sentinel<TIterator>{});
+}
+
+template <class... iters>
+class iterator_common_impl;
+
+template <class TIterator, class TReference>
+class iterator_common_impl<TIterator, TReference> : public linq_iterator_traits<TReference, iterator_category_t<TIterator>>
 {
+protected:
+    using self = iterator_common_impl<TIterator, TReference>;
+    using traits = linq_iterator_traits<TReference, iterator_category_t<TIterator>>;
+
+    TIterator _iter;
+
+    iterator_common_impl() = default;
+
+    explicit iterator_common_impl(const TIterator& iter)
+        : _iter(iter)
+    {
+    }
+
+    explicit iterator_common_impl(TIterator&& iter)
+        : _iter(std::move(iter))
+    {
+    }
+
 public:
-    using value_type = deref_iter_t<TIterator>;
+    using value_type = typename traits::value_type;
+    using pointer = typename traits::pointer;
+    using reference = typename traits::reference;
+    using difference_type = typename traits::difference_type;
+    using iterator_category = typename traits::iterator_category;
+    using sentinel = sentinel_t<TIterator>;
+
+    //the wrapped iterator, used by linq_collection to rewrite operator chains
+    const TIterator& source() const
+    {
+        return _iter;
+    }
+
+    sentinel end_sentinel() const
+    {
+        return linq_sentinel(_iter);
+    }
+
+    bool at_end(const sentinel& end) const
+    {
+        return linq_at_end(_iter, end);
+    }
+
+    difference_type distance_to_end(const sentinel& end) const
+    {
+        return linq_distance_to_end(_iter, end);
+    }
+
+    self& operator++()
+    {
+        ++_iter;
+        return *this;
+    }
+
+    self& operator--()
+    {
+        --_iter;
+        return *this;
+    }
+
+    self& operator+=(difference_type n)
+    {
+        _iter += n;
+        return *this;
+    }
+
+    self& operator-=(difference_type n)
+    {
+        _iter -= n;
+        return *this;
+    }
+
+    difference_type operator-(const self& other) const
+    {
+        return _iter - other._iter;
+    }
+
+    reference operator*() const
+    {
+        return *_iter;
+    }
+
+    bool operator==(const self& other) const
+    {
+        return _iter == other._iter;
+    }
+
+    bool operator!=(const self& other) const
+    {
+        return _iter != other._iter;
+    }
+
+    bool operator<(const self& other) const
+    {
+        return _iter < other._iter;
+    }
+
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        return linq_push(_iter, end._iter, sink);
+    }
+};
+
+template <class TIterator>
+class iterator_common_impl<TIterator> : public iterator_common_impl<TIterator, deref_ref_t<TIterator>>
+{
+protected:
+    using base = iterator_common_impl<TIterator, deref_ref_t<TIterator>>;
+    using traits = typename base::traits;
+    using value_type = typename traits::value_type;
+    using pointer = typename traits::pointer;
+    using reference = typename traits::reference;
+    using difference_type = typename traits::difference_type;
+    using iterator_category = typename traits::iterator_category;
+
+    iterator_common_impl() = default;
+
+    explicit iterator_common_impl(const TIterator& iter)
+        : iterator_common_impl<TIterator, deref_ref_t<TIterator>>(iter)
+    {
+    }
+
+    explicit iterator_common_impl(TIterator&& iter)
+        : iterator_common_impl<TIterator, deref_ref_t<TIterator>>(std::move(iter))
+    {
+    }
+
+};
+
+template <class TIterator, class TFunction>
+class select_iterator : public iterator_common_impl<TIterator, std::decay_t<decltype(std::declval<const TFunction&>()(std::declval<deref_ref_t<TIterator>>()))>>
+{
 private:
-    using self = linq_collection<TIterator>;
+    //select always yields a prvalue, a reference returned by the selector could point into a temporary element
+    using return_type = std::decay_t<decltype(std::declval<const TFunction&>()(std::declval<deref_ref_t<TIterator>>()))>;
+    using base = iterator_common_impl<TIterator, return_type>;
+    using self = select_iterator<TIterator, TFunction>;
 
-    TIterator _begin;
-    TIterator _end;
 
+    function_holder<TFunction> _func;
 public:
-    linq_collection(const TIterator& begin, const TIterator& end)
-        : _begin(begin)
-        , _end(end)
+
+    using value_type = typename base::value_type;
+    using pointer = typename base::pointer;
+    using reference = typename base::reference;
+    using difference_type = typename base::difference_type;
+    using iterator_category = typename base::iterator_category;
+
+    select_iterator() = default;
+
+    select_iterator(TIterator iter, const function_holder<TFunction>& func)
+        : base(std::move(iter))
+        , _func(func)
+    {
+    }
+
+    const TFunction& selector() const
+    {
+        return _func.get();
+    }
+
+    self& operator++()
+    {
+        ++base::_iter;
+        return *this;
+    }
+
+    self& operator--()
+    {
+        --base::_iter;
+        return *this;
+    }
+
+    auto operator*() const -> return_type
+    {
+        return _func(*base::_iter);
+    }
+
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        const auto& func = _func;
+        return linq_push(base::_iter, end._iter, [&func, &sink](auto&& x)
+                         {
+                             return sink(func(std::forward<decltype(x)>(x)));
+                         });
+    }
+};
+
+template <class TIterator, class TFunction>
+class where_iterator : public iterator_common_impl<TIterator>
+{
+private:
+    using base = iterator_common_impl<TIterator>;
+public:
+    using self = where_iterator<TIterator, TFunction>;
+
+    using value_type = typename base::value_type;
+    using pointer = typename base::pointer;
+    using reference = typename base::reference;
+    using difference_type = typename base::difference_type;
+    using iterator_category = weaker_category_t<std::forward_iterator_tag, typename base::iterator_category>;
+    using sentinel = typename base::sentinel;
+private:
+    sentinel _end;
+    function_holder<TFunction> _func;
+
+    void check_move_iterator()
+    {
+        while (!linq_at_end(base::_iter, _end) && !_func(*base::_iter))
+        {
+            ++base::_iter;
+        }
+    }
+
+public:
+    where_iterator() = default;
+
+    where_iterator(TIterator begin, sentinel end, const function_holder<TFunction>& func)
+        : base(std::move(begin))
+        , _end(std::move(end))
+        , _func(func)
+    {
+        check_move_iterator();
+    }
+
+    const sentinel& source_end() const
+    {
+        return _end;
+    }
+
+    const TFunction& predicate() const
+    {
+        return _func.get();
+    }
+
+    self& operator++()
+    {
+        ++base::_iter;
+        check_move_iterator();
+
+        return *this;
+    }
+
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        //the current element has already passed the predicate
+        if (base::_iter == end._iter)
+        {
+            return true;
+        }
+        if (!sink(*base::_iter))
+        {
+            return false;
+        }
+        ++base::_iter;
+
+        const auto& func = _func;
+        return linq_push(base::_iter, end._iter, [&func, &sink](auto&& x)
+                         {
+                             return !func(x) || sink(std::forward<decltype(x)>(x));
+                         });
+    }
+};
+
+template <class TIterator>
+class skip_iterator : public iterator_common_impl<TIterator>
+{
+private:
+    using base = iterator_common_impl<TIterator>;
+    using self = skip_iterator<TIterator>;
+public:
+    using value_type = typename base::value_type;
+    using pointer = typename base::pointer;
+    using reference = typename base::reference;
+    using difference_type = typename base::difference_type;
+    using iterator_category = typename base::iterator_category;
+    using sentinel = typename base::sentinel;
+
+    skip_iterator() = default;
+
+    skip_iterator(const TIterator& iter, const sentinel& end, std::size_t count)
+        : base(iter)
+    {
+        for (; count != 0 && !linq_at_end(base::_iter, end); count--)
+        {
+            ++base::_iter;
+        }
+    }
+
+    self& operator++()
+    {
+        ++base::_iter;
+        return *this;
+    }
+
+    self& operator--()
+    {
+        --base::_iter;
+        return *this;
+    }
+};
+
+template <class TIterator, class TFunction>
+class skip_while_iterator : public iterator_common_impl<TIterator>
+{
+private:
+    using base = iterator_common_impl<TIterator>;
+    using self = skip_while_iterator<TIterator, TFunction>;
+
+    function_holder<TFunction> _func;
+public:
+
+    using value_type = typename base::value_type;
+    using pointer = typename base::pointer;
+    using reference = typename base::reference;
+    using difference_type = typename base::difference_type;
+    using iterator_category = weaker_category_t<std::forward_iterator_tag, typename base::iterator_category>;
+    using sentinel = typename base::sentinel;
+
+    skip_while_iterator() = default;
+
+    skip_while_iterator(TIterator iter, const sentinel& end, const function_holder<TFunction>& func)
+        : base(std::move(iter))
+        , _func(func)
+    {
+        while (!linq_at_end(base::_iter, end) && _func(*base::_iter))
+        {
+            ++base::_iter;
+        }
+    }
+
+    const TFunction& predicate() const
+    {
+        return _func.get();
+    }
+
+    self& operator++()
+    {
+        ++base::_iter;
+        return *this;
+    }
+};
+
+template <class TIterator>
+class take_iterator : public iterator_common_impl<TIterator>
+{
+    using base = iterator_common_impl<TIterator>;
+    using self = take_iterator<TIterator>;
+public:
+    using value_type = typename base::value_type;
+    using pointer = typename base::pointer;
+    using reference = typename base::reference;
+    using difference_type = typename base::difference_type;
+    //random access sources are sliced instead, see linq_collection::take
+    using iterator_category = weaker_category_t<std::forward_iterator_tag, typename base::iterator_category>;
+    using sentinel = typename base::sentinel;
+
+private:
+    sentinel _end;
+    std::size_t _current;
+    std::size_t _count;
+public:
+    take_iterator() = default;
+
+    take_iterator(const TIterator& iter, const sentinel& end, std::size_t count)
+        : iterator_common_impl<TIterator>(iter)
+        , _end(end)
+        , _current(0)
+        , _count(count)
+    {
+    }
+
+    //after the last taken element the source is not advanced any further
+    bool at_end(const sentinel& end) const
+    {
+        return _current == _count || linq_at_end(base::_iter, end);
+    }
+
+    self& operator++()
+    {
+        if (++_current != _count)
+        {
+            ++base::_iter;
+        }
+        return *this;
+    }
+
+    bool operator==(const self& other) const
+    {
+        bool finished = at_end(_end);
+        bool other_finished = other.at_end(other._end);
+        return finished || other_finished ? finished == other_finished : base::_iter == other._iter;
+    }
+
+    bool operator!=(const self& other) const
+    {
+        return !((*this) == other);
+    }
+
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        if (at_end(_end))
+        {
+            return true;
+        }
+        bool stopped = false;
+        auto& current = _current;
+        auto count = _count;
+        linq_push(base::_iter, end._iter, [&stopped, &current, count, &sink](auto&& x)
+                  {
+                      if (!sink(std::forward<decltype(x)>(x)))
+                      {
+                          stopped = true;
+                          return false;
+                      }
+                      return ++current != count;
+                  });
+        return !stopped;
+    }
+};
+
+template <class TIterator, class TFunction>
+class take_while_iterator : public iterator_common_impl<TIterator>
+{
+    using base = iterator_common_impl<TIterator>;
+    using self = take_while_iterator<TIterator, TFunction>;
+public:
+    using value_type = typename base::value_type;
+    using pointer = typename base::pointer;
+    using reference = typename base::reference;
+    using difference_type = typename base::difference_type;
+    using iterator_category = weaker_category_t<std::forward_iterator_tag, typename base::iterator_category>;
+    using sentinel = typename base::sentinel;
+
+private:
+    sentinel _end;
+    function_holder<TFunction> _func;
+    bool _stopped;
+
+    void check_stop()
+    {
+        _stopped = !linq_at_end(base::_iter, _end) && !_func(*base::_iter);
+    }
+
+public:
+    take_while_iterator() = default;
+
+    take_while_iterator(TIterator begin, sentinel end, const function_holder<TFunction>& func)
+        : iterator_common_impl<TIterator>(std::move(begin))
+        , _end(std::move(end))
+        , _func(func)
+    {
+        check_stop();
+    }
+
+    const TFunction& predicate() const
+    {
+        return _func.get();
+    }
+
+    //the first rejected element ends the sequence without an end iterator to jump to
+    bool at_end(const sentinel& end) const
+    {
+        return _stopped || linq_at_end(base::_iter, end);
+    }
+
+    self& operator++()
+    {
+        ++base::_iter;
+        check_stop();
+        return *this;
+    }
+
+    bool operator==(const self& other) const
+    {
+        bool finished = at_end(_end);
+        bool other_finished = other.at_end(other._end);
+        return finished || other_finished ? finished == other_finished : base::_iter == other._iter;
+    }
+
+    bool operator!=(const self& other) const
+    {
+        return !((*this) == other);
+    }
+
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        if (_stopped)
+        {
+            return true;
+        }
+        bool stopped = false;
+        const auto& func = _func;
+        linq_push(base::_iter, end._iter, [&stopped, &func, &sink](auto&& x)
+                  {
+                      if (!func(x))
+                      {
+                          return false;
+                      }
+                      if (!sink(std::forward<decltype(x)>(x)))
+                      {
+                          stopped = true;
+                          return false;
+                      }
+                      return true;
+                  });
+        return !stopped;
+    }
+};
+
+struct identity_selector
+{
+    template <class T>
+    const T& operator()(const T& value) const
+    {
+        return value;
+    }
+};
+
+//where(a).where(b) is rewritten into a single where with this predicate
+template <class TFunction1, class TFunction2>
+struct fused_predicate
+{
+    TFunction1 first;
+    TFunction2 second;
+
+    template <class T>
+    bool operator()(T&& value) const
+    {
+        return first(value) && second(value);
+    }
+};
+
+//select(f).select(g) is rewritten into a single select with this selector
+template <class TFunction1, class TFunction2>
+struct fused_selector
+{
+    TFunction1 first;
+    TFunction2 second;
+
+    //decayed like select_iterator, g may return a reference into the temporary result of f
+    template <class T>
+    auto operator()(T&& value) const -> std::decay_t<decltype(second(first(std::forward<T>(value))))>
+    {
+        return second(first(std::forward<T>(value)));
+    }
+};
+
+/*
+ * opt-in instrumentation, compiled out unless PL_LINQ_INSTRUMENT is defined before including linq.h.
+ * select, where, skip_while, take_while and select_many then wrap their function in an instrumented_function,
+ * every copy of a stage shares one stage_counters, and explain() prints them next to the stage.
+ * time and allocations cover the calls of the function only, not the iteration around it.
+ * heap allocations are counted when PL_LINQ_INSTRUMENT_NEW is defined in exactly one translation unit,
+ * which replaces the global operator new.
+ */
+#ifdef PL_LINQ_INSTRUMENT
+struct stage_counters
+{
+    std::atomic<std::size_t> calls{0};
+    std::atomic<std::size_t> passed{0};
+    std::atomic<std::size_t> allocations{0};
+    std::atomic<long long> nanoseconds{0};
+};
+
+inline std::size_t& thread_allocations()
+{
+    static thread_local std::size_t count = 0;
+    return count;
+}
+
+template <class TFunction, bool IsPredicate>
+class instrumented_function
+{
+private:
+    TFunction _func;
+    std::shared_ptr<stage_counters> _counters;
+
+    template <class TResult>
+    static bool passes(const TResult& result, std::true_type)
+    {
+        return static_cast<bool>(result);
+    }
+
+    template <class TResult>
+    static bool passes(const TResult&, std::false_type)
+    {
+        return true;
+    }
+
+public:
+    explicit instrumented_function(const TFunction& func)
+        : _func(func)
+        , _counters(std::make_shared<stage_counters>())
+    {
+    }
+
+    explicit instrumented_function(TFunction&& func)
+        : _func(std::move(func))
+        , _counters(std::make_shared<stage_counters>())
+    {
+    }
+
+    const stage_counters& counters() const
+    {
+        return *_counters;
+    }
+
+    template <class... TArgs>
+    auto operator()(TArgs&&... args) const -> decltype(std::declval<const TFunction&>()(std::forward<TArgs>(args)...))
+    {
+        auto allocations = thread_allocations();
+        auto start = std::chrono::steady_clock::now();
+        decltype(auto) result = _func(std::forward<TArgs>(args)...);
+        _counters->nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        _counters->allocations += thread_allocations() - allocations;
+        _counters->calls++;
+        if (passes(result, std::integral_constant<bool, IsPredicate>{}))
+        {
+            _counters->passed++;
+        }
+        return std::forward<decltype(result)>(result);
+    }
+};
+
+template <bool IsPredicate, class TFunction>
+instrumented_function<std::decay_t<TFunction>, IsPredicate> instrument_stage(TFunction&& func)
+{
+    return instrumented_function<std::decay_t<TFunction>, IsPredicate>{std::forward<TFunction>(func)};
+}
+#else
+template <bool IsPredicate, class TFunction>
+TFunction&& instrument_stage(TFunction&& func)
+{
+    return std::forward<TFunction>(func);
+}
+#endif
+
+/*
+ * remembers the position where every key was first seen.
+ * Every traversal visits the elements in the same order,
+ * so iterators copied from the same collection can share one table.
+ */
+template <class TKey, class THash, class TEqual>
+class first_seen_table
+{
+private:
+    arena_unordered_map<TKey, std::size_t, THash, TEqual> _positions;
+public:
+    first_seen_table(const THash& hash, const TEqual& eq)
+        : _positions(0, hash, eq)
+    {
+    }
+
+    //an empty table with the same hash and equality, drawn from the current memory resource
+    std::shared_ptr<first_seen_table> renew() const
+    {
+        return make_arena_shared<first_seen_table>(_positions.hash_function(), _positions.key_eq());
+    }
+
+    template <class TValue>
+    bool is_first(TValue&& key, std::size_t position)
+    {
+        auto iter = _positions.find(key);
+        if (iter == _positions.end())
+        {
+            _positions.emplace(std::forward<TValue>(key), position);
+            return true;
+        }
+        return iter->second == position;
+    }
+};
+
+template <class TIterator, class TFunction, class TTable>
+class distinct_iterator : public iterator_common_impl<TIterator>
+{
+private:
+    using base = iterator_common_impl<TIterator>;
+    using self = distinct_iterator<TIterator, TFunction, TTable>;
+public:
+    using value_type = typename base::value_type;
+    using pointer = typename base::pointer;
+    using reference = typename base::reference;
+    using difference_type = typename base::difference_type;
+    using iterator_category = weaker_category_t<std::forward_iterator_tag, typename base::iterator_category>;
+    using sentinel = typename base::sentinel;
+private:
+    sentinel _end;
+    function_holder<TFunction> _keySelector;
+    //never filled, only gives every enumeration an empty table of the same kind
+    std::shared_ptr<const TTable> _prototype;
+    std::shared_ptr<TTable> _table;
+    std::size_t _position;
+
+    /*
+     * the table is created when an enumeration moves past its first element, which is recorded first.
+     * Copies made after that share it, which keeps them consistent because every key is recorded
+     * at its first position, but they must not be advanced from different threads
+     */
+    TTable& table()
+    {
+        if (!_table)
+        {
+            _table = _prototype->renew();
+            _table->is_first(_keySelector(*base::_iter), _position);
+        }
+        return *_table;
+    }
+
+    void check_move_iterator(TTable& seen)
+    {
+        while (!linq_at_end(base::_iter, _end) && !seen.is_first(_keySelector(*base::_iter), _position))
+        {
+            ++base::_iter;
+            ++_position;
+        }
+    }
+
+public:
+    distinct_iterator() = default;
+
+    //the first element is always the first of its key, so nothing is skipped here
+    distinct_iterator(const TIterator& begin, const sentinel& end, const TFunction& keySelector, const std::shared_ptr<const TTable>& prototype)
+        : base(begin)
+        , _end(end)
+        , _keySelector(keySelector)
+        , _prototype(prototype)
+        , _position(0)
+    {
+    }
+
+    self& operator++()
+    {
+        auto& seen = table();
+        ++base::_iter;
+        ++_position;
+        check_move_iterator(seen);
+
+        return *this;
+    }
+
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        //the current element has already been seen first here
+        if (base::_iter == end._iter)
+        {
+            return true;
+        }
+        auto& table = this->table();
+        if (!sink(*base::_iter))
+        {
+            return false;
+        }
+        ++base::_iter;
+
+        auto position = _position;
+        const auto& keySelector = _keySelector;
+        return linq_push(base::_iter, end._iter, [&position, &keySelector, &table, &sink](auto&& x)
+                         {
+                             return !table.is_first(keySelector(x), ++position) || sink(std::forward<decltype(x)>(x));
+                         });
+    }
+};
+
+template <class TIterator1, class TIterator2, class TReference>
+class iterator_common_impl<TIterator1, TIterator2, TReference>
+    : public linq_iterator_traits<TReference, weaker_category_t<iterator_category_t<TIterator1>, iterator_category_t<TIterator2>>>
+{
+private:
+    using self = iterator_common_impl<TIterator1, TIterator2, TReference>;
+
+protected:
+    using traits = linq_iterator_traits<TReference, weaker_category_t<iterator_category_t<TIterator1>, iterator_category_t<TIterator2>>>;
+    using value_type = typename traits::value_type;
+    using pointer = typename traits::pointer;
+    using reference = typename traits::reference;
+    using difference_type = typename traits::difference_type;
+    using iterator_category = typename traits::iterator_category;
+
+    TIterator1 _iter1;
+    TIterator2 _iter2;
+
+    iterator_common_impl() = default;
+
+    iterator_common_impl(TIterator1 iter1, TIterator2 iter2)
+        : _iter1(iter1)
+        , _iter2(iter2)
+    {
+    }
+
+public:
+    const TIterator1& first_source() const
+    {
+        return _iter1;
+    }
+
+    const TIterator2& second_source() const
+    {
+        return _iter2;
+    }
+
+    self& operator++()
+    {
+        return *this;
+    }
+
+    value_type operator*()
+    {
+        return value_type{};
+    }
+
+    bool operator==(const self& other) const
+    {
+        return _iter1 == other._iter1 && _iter2 == other._iter2;
+    }
+
+    bool operator!=(const self& other) const
+    {
+        return !((*this) == other);
+    }
+};
+
+template <class TIterator1, class TIterator2>
+class concat_iterator : public iterator_common_impl<TIterator1, TIterator2, common_ref_t<deref_ref_t<TIterator1>, deref_ref_t<TIterator2>>>
+{
+private:
+    using self = concat_iterator<TIterator1, TIterator2>;
+    using base = iterator_common_impl<TIterator1, TIterator2, common_ref_t<deref_ref_t<TIterator1>, deref_ref_t<TIterator2>>>;
+public:
+    using value_type = typename base::value_type;
+    using pointer = typename base::pointer;
+    using reference = typename base::reference;
+    using difference_type = typename base::difference_type;
+    using iterator_category = typename base::iterator_category;
+    //the end of a concatenation is the end of its second range
+    using sentinel = sentinel_t<TIterator2>;
+private:
+    //the start of the second range is only needed to step back into the first one
+    using begin2_type = std::conditional_t<is_bidirectional<TIterator2>::value, TIterator2, std::tuple<>>;
+
+    sentinel_t<TIterator1> _end1;
+    begin2_type _begin2;
+
+    static begin2_type keep_begin2(const TIterator2& begin2, std::true_type)
+    {
+        return begin2;
+    }
+
+    static begin2_type keep_begin2(const TIterator2&, std::false_type)
+    {
+        return {};
+    }
+
+    bool first_done() const
+    {
+        return linq_at_end(base::_iter1, _end1);
+    }
+
+public:
+    concat_iterator() = default;
+
+    concat_iterator(const TIterator1& iter1, const TIterator1& end1, const TIterator2& begin2, const TIterator2& iter2)
+        : base(iter1, iter2)
+        , _end1(linq_sentinel(end1))
+        , _begin2(keep_begin2(begin2, is_bidirectional<TIterator2>{}))
+    {
+    }
+
+    sentinel end_sentinel() const
+    {
+        return linq_sentinel(base::_iter2);
+    }
+
+    bool at_end(const sentinel& end) const
+    {
+        return first_done() && linq_at_end(base::_iter2, end);
+    }
+
+    difference_type distance_to_end(const sentinel& end) const
+    {
+        return linq_distance_to_end(base::_iter1, _end1) + linq_distance_to_end(base::_iter2, end);
+    }
+
+    self& operator++()
+    {
+        if (!first_done())
+        {
+            ++base::_iter1;
+        }
+        else
+        {
+            ++base::_iter2;
+        }
+        return *this;
+    }
+
+    self& operator--()
+    {
+        if (base::_iter2 != _begin2)
+        {
+            --base::_iter2;
+        }
+        else
+        {
+            --base::_iter1;
+        }
+        return *this;
+    }
+
+    self& operator+=(difference_type n)
+    {
+        if (n >= 0)
+        {
+            difference_type rest1 = linq_distance_to_end(base::_iter1, _end1);
+            if (n <= rest1)
+            {
+                base::_iter1 += n;
+            }
+            else
+            {
+                base::_iter1 += rest1;
+                base::_iter2 += n - rest1;
+            }
+        }
+        else
+        {
+            auto done2 = base::_iter2 - _begin2;
+            if (-n <= done2)
+            {
+                base::_iter2 += n;
+            }
+            else
+            {
+                base::_iter2 = _begin2;
+                base::_iter1 += n + done2;
+            }
+        }
+        return *this;
+    }
+
+    self& operator-=(difference_type n)
+    {
+        return *this += -n;
+    }
+
+    difference_type operator-(const self& other) const
+    {
+        return (base::_iter1 - other._iter1) + (base::_iter2 - other._iter2);
+    }
+
+    reference operator*() const
+    {
+        if (!first_done())
+        {
+            return *base::_iter1;
+        }
+        return *base::_iter2;
+    }
+
+    //the first range of an end iterator is always exhausted
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        return linq_push(base::_iter1, end._iter1, sink) && linq_push(base::_iter2, end._iter2, sink);
+    }
+};
+
+template <class TIterator1, class TIterator2>
+class zip_iterator : public iterator_common_impl<TIterator1,
+                                                 TIterator2,
+                                                 std::pair<deref_iter_t<TIterator1>,
+                                                           deref_iter_t<TIterator2>>>
+{
+private:
+    using self = zip_iterator<TIterator1, TIterator2>;
+    using base = iterator_common_impl<TIterator1,
+                                      TIterator2,
+                                      std::pair<deref_iter_t<TIterator1>,
+                                                deref_iter_t<TIterator2>>>;
+
+    sentinel_t<TIterator1> _end1;
+    sentinel_t<TIterator2> _end2;
+
+    bool at_end() const
+    {
+        return linq_at_end(base::_iter1, _end1) || linq_at_end(base::_iter2, _end2);
+    }
+public:
+    using value_type = typename base::value_type;
+    using pointer = typename base::pointer;
+    using reference = typename base::reference;
+    using difference_type = typename base::difference_type;
+    //zip_with clamps both ends to the shorter side only for random access sources
+    using iterator_category = std::conditional_t<std::is_same<typename base::iterator_category, std::random_access_iterator_tag>::value,
+                                                 std::random_access_iterator_tag,
+                                                 weaker_category_t<std::forward_iterator_tag, typename base::iterator_category>>;
+
+    zip_iterator() = default;
+
+    zip_iterator(const TIterator1& begin1, const TIterator1& end1, const TIterator2& begin2, const TIterator2& end2)
+        : base(begin1, begin2)
+        , _end1(linq_sentinel(end1))
+        , _end2(linq_sentinel(end2))
+    {
+    }
+
+    self& operator++()
+    {
+        if (!at_end())
+        {
+            ++base::_iter1;
+            ++base::_iter2;
+        }
+        return *this;
+    }
+
+    self& operator--()
+    {
+        --base::_iter1;
+        --base::_iter2;
+        return *this;
+    }
+
+    self& operator+=(difference_type n)
+    {
+        base::_iter1 += n;
+        base::_iter2 += n;
+        return *this;
+    }
+
+    self& operator-=(difference_type n)
+    {
+        return *this += -n;
+    }
+
+    difference_type operator-(const self& other) const
+    {
+        return base::_iter1 - other._iter1;
+    }
+
+    //the shorter side decides where the zipped sequence ends
+    bool operator==(const self& other) const
+    {
+        return base::_iter1 == other._iter1 || base::_iter2 == other._iter2;
+    }
+
+    bool operator!=(const self& other) const
+    {
+        return !((*this) == other);
+    }
+
+    value_type operator*() const
+    {
+        return value_type{*base::_iter1, *base::_iter2};
+    }
+
+    template <class TSink>
+    bool push(const self&, TSink& sink)
+    {
+        for (; !at_end(); ++base::_iter1, ++base::_iter2)
+        {
+            if (!sink(value_type{*base::_iter1, *base::_iter2}))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+template <class TContainer>
+class boxed_container_iterator : public iterator_common_impl<decltype(std::begin(std::declval<TContainer>()))>
+{
+private:
+    using self = boxed_container_iterator<TContainer>;
+    using base = iterator_common_impl<decltype(std::begin(std::declval<TContainer>()))>;
+public:
+    using iterator_type = decltype(std::begin(std::declval<TContainer>()));
+
+    using value_type = typename base::value_type;
+    using pointer = typename base::pointer;
+    using reference = typename base::reference;
+    using difference_type = typename base::difference_type;
+    using iterator_category = typename base::iterator_category;
+
+    std::shared_ptr<TContainer> _container;
+
+    boxed_container_iterator() = default;
+
+    boxed_container_iterator(const std::shared_ptr<TContainer>& container, const iterator_type& iterator)
+        : base(iterator)
+        , _container(container)
+    {
+    }
+
+    self& operator++()
+    {
+        ++base::_iter;
+        return *this;
+    }
+
+    self& operator--()
+    {
+        --base::_iter;
+        return *this;
+    }
+};
+
+#ifdef PL_LINQ_HAS_STRING_VIEW
+using line_view = std::string_view;
+#else
+//the part of std::string_view that line sources need
+class line_view
+{
+private:
+    const char* _data;
+    std::size_t _size;
+
+public:
+    using value_type = char;
+    using iterator = const char*;
+    using const_iterator = const char*;
+
+    line_view() noexcept
+        : _data(nullptr)
+        , _size(0)
+    {
+    }
+
+    line_view(const char* data, std::size_t size) noexcept
+        : _data(data)
+        , _size(size)
+    {
+    }
+
+    line_view(const char* str)
+        : _data(str)
+        , _size(std::strlen(str))
+    {
+    }
+
+    const char* data() const noexcept
+    {
+        return _data;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return _size;
+    }
+
+    bool empty() const noexcept
+    {
+        return _size == 0;
+    }
+
+    const char* begin() const noexcept
+    {
+        return _data;
+    }
+
+    const char* end() const noexcept
+    {
+        return _data + _size;
+    }
+
+    char operator[](std::size_t index) const
+    {
+        return _data[index];
+    }
+
+    explicit operator std::string() const
+    {
+        return std::string(_data, _size);
+    }
+
+    friend bool operator==(const line_view& a, const line_view& b)
+    {
+        return a._size == b._size && std::equal(a.begin(), a.end(), b.begin());
+    }
+
+    friend bool operator!=(const line_view& a, const line_view& b)
+    {
+        return !(a == b);
+    }
+};
+#endif
+
+/*
+ * splits a stream into lines that point into a block buffer, without the line break.
+ * A line is only valid until the reader moves past it, a line longer than the buffer grows the buffer
+ */
+class line_reader
+{
+private:
+    std::unique_ptr<std::istream> _owned;
+    std::istream& _stream;
+    std::vector<char> _buffer;
+    std::size_t _next;
+    std::size_t _filled;
+    //stream offset of the start of the buffer, lines starting at or after the limit are not read
+    std::size_t _base;
+    std::size_t _limit;
+    bool _skip_first;
+    line_view _line;
+    bool _started;
+    bool _done;
+
+    //moves the unread tail to the front of the buffer and reads the next block behind it
+    bool refill()
+    {
+        std::size_t rest = _filled - _next;
+        if (rest != 0 && _next != 0)
+        {
+            std::memmove(_buffer.data(), _buffer.data() + _next, rest);
+        }
+        _base += _next;
+        if (rest == _buffer.size())
+        {
+            _buffer.resize(_buffer.size() * 2);
+        }
+        _next = 0;
+        _filled = rest;
+
+        _stream.read(_buffer.data() + rest, static_cast<std::streamsize>(_buffer.size() - rest));
+        auto count = static_cast<std::size_t>(_stream.gcount());
+        _filled += count;
+        return count != 0;
+    }
+
+    void set_line(const char* first, std::size_t size)
+    {
+        if (size != 0 && first[size - 1] == '\r')
+        {
+            size--;
+        }
+        _line = line_view(first, size);
+    }
+
+    bool read_line()
+    {
+        if (_base + _next >= _limit)
+        {
+            return false;
+        }
+        for (;;)
+        {
+            const char* first = _buffer.data() + _next;
+            std::size_t rest = _filled - _next;
+            if (auto newline = static_cast<const char*>(std::memchr(first, '\n', rest)))
+            {
+                auto size = static_cast<std::size_t>(newline - first);
+                set_line(first, size);
+                _next += size + 1;
+                return true;
+            }
+            if (!refill())
+            {
+                if (_next == _filled)
+                {
+                    return false;
+                }
+                set_line(_buffer.data() + _next, _filled - _next);
+                _next = _filled;
+                return true;
+            }
+        }
+    }
+
+    //nothing is read before the query asks for the first line
+    void start()
+    {
+        if (!_started)
+        {
+            _started = true;
+            _done = !read_line() || (_skip_first && !read_line());
+        }
+    }
+
+public:
+    using reference = line_view;
+
+    static constexpr std::size_t default_block_size = 64 * 1024;
+
+    line_reader(std::istream& stream, std::size_t block_size)
+        : _stream(stream)
+        , _buffer(std::max<std::size_t>(block_size, 1))
+        , _next(0)
+        , _filled(0)
+        , _base(0)
+        , _limit(static_cast<std::size_t>(-1))
+        , _skip_first(false)
+        , _started(false)
+        , _done(false)
+    {
+    }
+
+    /*
+     * reads the lines starting in the first limit bytes of the stream.
+     * With skip_first the line the stream starts in belongs to an earlier range and is dropped
+     */
+    line_reader(std::unique_ptr<std::istream> stream, std::size_t block_size, bool skip_first, std::size_t limit)
+        : line_reader(std::move(stream), block_size)
+    {
+        _skip_first = skip_first;
+        _limit = limit;
+    }
+
+    line_reader(std::unique_ptr<std::istream> stream, std::size_t block_size)
+        : _owned(std::move(stream))
+        , _stream(*_owned)
+        , _buffer(std::max<std::size_t>(block_size, 1))
+        , _next(0)
+        , _filled(0)
+        , _base(0)
+        , _limit(static_cast<std::size_t>(-1))
+        , _skip_first(false)
+        , _started(false)
+        , _done(false)
+    {
+    }
+
+    bool done()
+    {
+        start();
+        return _done;
+    }
+
+    const line_view& current()
+    {
+        start();
+        return _line;
+    }
+
+    void advance()
+    {
+        start();
+        _done = _done || !read_line();
+    }
+};
+
+/*
+ * single pass iterator over a reader that parses a stream record by record,
+ * copies share the reader like std::istream_iterator
+ */
+template <class TReader>
+class reader_iterator : public linq_iterator_traits<typename TReader::reference, std::input_iterator_tag>
+{
+private:
+    using self = reader_iterator<TReader>;
+    using traits = linq_iterator_traits<typename TReader::reference, std::input_iterator_tag>;
+
+    //null for the end iterator
+    std::shared_ptr<TReader> _reader;
+
+    bool exhausted() const
+    {
+        return !_reader || _reader->done();
+    }
+
+public:
+    using value_type = typename traits::value_type;
+    using pointer = typename traits::pointer;
+    using reference = typename traits::reference;
+    using difference_type = typename traits::difference_type;
+    using iterator_category = typename traits::iterator_category;
+
+    reader_iterator() = default;
+
+    explicit reader_iterator(const std::shared_ptr<TReader>& reader)
+        : _reader(reader)
+    {
+    }
+
+    self& operator++()
+    {
+        _reader->advance();
+        return *this;
+    }
+
+    reference operator*() const
+    {
+        return _reader->current();
+    }
+
+    bool operator==(const self& other) const
+    {
+        bool end = exhausted();
+        return end == other.exhausted() && (end || _reader == other._reader);
+    }
+
+    bool operator!=(const self& other) const
+    {
+        return !((*this) == other);
+    }
+
+    template <class TSink>
+    bool push(const self&, TSink& sink)
+    {
+        for (; !exhausted(); _reader->advance())
+        {
+            if (!sink(_reader->current()))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+using line_iterator = reader_iterator<line_reader>;
+
+#ifdef PL_LINQ_HAS_COROUTINES
+/*
+ * a coroutine producing elements with co_yield, resumed each time the query asks for the next one.
+ * Yielded values are referenced, not copied, and stay valid until the coroutine is resumed.
+ * Frames are allocated from the memory resource installed for the thread that calls the coroutine
+ * and given back to it when the generator is destroyed, so a frame may outlive the memory_scope
+ */
+template <class T>
+class generator
+{
+    static_assert(!std::is_reference<T>::value, "generator yields values, a reference to them is kept");
+
+public:
+    class promise_type
+    {
+    private:
+        const T* _value = nullptr;
+        std::exception_ptr _error;
+
+        friend class generator<T>;
+
+        //kept in front of the frame so the frame can be given back to the resource it came from
+        struct frame_header
+        {
+            memory_resource* resource;
+            std::size_t size;
+        };
+
+        static constexpr std::size_t header_size = (sizeof(frame_header) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+    public:
+        generator get_return_object()
+        {
+            return generator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        //nothing runs before the query asks for the first element
+        std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() const noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always yield_value(const T& value) noexcept
+        {
+            _value = std::addressof(value);
+            return {};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        void unhandled_exception()
+        {
+            _error = std::current_exception();
+        }
+
+        //a generator is only suspended by co_yield
+        template <class U>
+        std::suspend_never await_transform(U&&) = delete;
+
+        static void* operator new(std::size_t size)
+        {
+            auto resource = current_memory_resource();
+            auto total = header_size + size;
+            void* block = resource ? resource->allocate(total, alignof(std::max_align_t)) : ::operator new(total);
+            ::new (block) frame_header{resource, total};
+            return static_cast<char*>(block) + header_size;
+        }
+
+        static void operator delete(void* frame) noexcept
+        {
+            void* block = static_cast<char*>(frame) - header_size;
+            auto header = *static_cast<frame_header*>(block);
+            if (header.resource)
+            {
+                header.resource->deallocate(block, header.size, alignof(std::max_align_t));
+            }
+            else
+            {
+                ::operator delete(block);
+            }
+        }
+
+    };
+
+private:
+    std::coroutine_handle<promise_type> _coroutine;
+    bool _started;
+
+    explicit generator(std::coroutine_handle<promise_type> coroutine)
+        : _coroutine(coroutine)
+        , _started(false)
+    {
+    }
+
+    //exceptions thrown by the coroutine surface where the query asked for the next element
+    void resume()
+    {
+        _coroutine.resume();
+        if (auto error = std::exchange(_coroutine.promise()._error, nullptr))
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+    void start()
+    {
+        if (!_started)
+        {
+            _started = true;
+            resume();
+        }
+    }
+
+public:
+    using reference = const T&;
+
+    generator(generator&& other) noexcept
+        : _coroutine(std::exchange(other._coroutine, nullptr))
+        , _started(other._started)
+    {
+    }
+
+    generator& operator=(generator&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (_coroutine)
+            {
+                _coroutine.destroy();
+            }
+            _coroutine = std::exchange(other._coroutine, nullptr);
+            _started = other._started;
+        }
+        return *this;
+    }
+
+    generator(const generator&) = delete;
+    generator& operator=(const generator&) = delete;
+
+    ~generator()
+    {
+        if (_coroutine)
+        {
+            _coroutine.destroy();
+        }
+    }
+
+    bool done()
+    {
+        start();
+        return _coroutine.done();
+    }
+
+    const T& current()
+    {
+        start();
+        return *_coroutine.promise()._value;
+    }
+
+    void advance()
+    {
+        start();
+        if (!_coroutine.done())
+        {
+            resume();
+        }
+    }
+};
+#endif
+
+#if defined(PL_LINQ_MMAP_WIN32) || defined(PL_LINQ_MMAP_POSIX)
+//how a query is going to read a mapped file, passed on to the kernel's read-ahead
+enum class mmap_access
+{
+    normal,
+    sequential,
+    random,
+};
+
+//a read-only mapping of a whole file
+class mapped_file
+{
+private:
+    const void* _data;
+    std::size_t _size;
+#ifdef PL_LINQ_MMAP_WIN32
+    HANDLE _mapping;
+#endif
+
+public:
+    mapped_file(const std::string& path, mmap_access access)
+        : _data(nullptr)
+        , _size(0)
+#ifdef PL_LINQ_MMAP_WIN32
+        , _mapping(nullptr)
+#endif
+    {
+#ifdef PL_LINQ_MMAP_WIN32
+        //windows has no read-ahead hint for mapped views, the access pattern is ignored
+        (void)access;
+        HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER size;
+        if (file == INVALID_HANDLE_VALUE || !::GetFileSizeEx(file, &size))
+        {
+            if (file != INVALID_HANDLE_VALUE)
+            {
+                ::CloseHandle(file);
+            }
+            throw file_not_readable("cannot open " + path);
+        }
+        _size = static_cast<std::size_t>(size.QuadPart);
+        if (_size != 0)
+        {
+            _mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            _data = _mapping ? ::MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        }
+        ::CloseHandle(file);
+        if (_size != 0 && !_data)
+        {
+            if (_mapping)
+            {
+                ::CloseHandle(_mapping);
+            }
+            throw file_not_readable("cannot map " + path);
+        }
+#else
+        int file = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (file < 0 || ::fstat(file, &info) != 0)
+        {
+            if (file >= 0)
+            {
+                ::close(file);
+            }
+            throw file_not_readable("cannot open " + path);
+        }
+        _size = static_cast<std::size_t>(info.st_size);
+        //an empty file cannot be mapped, it is an empty sequence
+        void* data = _size != 0 ? ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, file, 0) : nullptr;
+        ::close(file);
+        if (data == MAP_FAILED)
+        {
+            throw file_not_readable("cannot map " + path);
+        }
+        if (data && access != mmap_access::normal)
+        {
+            ::posix_madvise(data, _size, access == mmap_access::sequential ? POSIX_MADV_SEQUENTIAL : POSIX_MADV_RANDOM);
+        }
+        _data = data;
+#endif
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file()
+    {
+#ifdef PL_LINQ_MMAP_WIN32
+        if (_data)
+        {
+            ::UnmapViewOfFile(_data);
+            ::CloseHandle(_mapping);
+        }
+#else
+        if (_data)
+        {
+            ::munmap(const_cast<void*>(_data), _size);
+        }
+#endif
+    }
+
+    const void* data() const
+    {
+        return _data;
+    }
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+};
+
+//a mapped file viewed as an array of fixed-size records
+template <class T>
+class mapped_records
+{
+    static_assert(std::is_trivially_copyable<T>::value, "mapped records are read from the file as they are");
+
+private:
+    mapped_file _file;
+
+public:
+    mapped_records(const std::string& path, mmap_access access)
+        : _file(path, access)
+    {
+        if (_file.size() % sizeof(T) != 0)
+        {
+            throw file_not_readable(path + " does not contain whole records");
+        }
+    }
+
+    const T* begin() const
+    {
+        return static_cast<const T*>(_file.data());
+    }
+
+    const T* end() const
+    {
+        return begin() + _file.size() / sizeof(T);
+    }
+};
+#endif
+
+template <class T>
+class empty_iterator : public linq_iterator_traits<T>
+{
+private:
+    using self = empty_iterator<T>;
+public:
+
+    using traits = linq_iterator_traits<T>;
+    using value_type = typename traits::value_type;
+    using pointer = typename traits::pointer;
+    using reference = typename traits::reference;
+    using difference_type = typename traits::difference_type;
+    using iterator_category = typename traits::iterator_category;
+
+    self& operator++()
+    {
+        return *this;
+    }
+
+    [[noreturn]]
+
+    value_type operator*() const
+    {
+        throw collection_empty("collection is empty");
+    }
+
+    bool operator==(const self&) const
+    {
+        return true;
+    }
+
+    bool operator!=(const self&) const
+    {
+        return false;
+    }
+};
+
+
+template <class TIterator>
+struct any_iterator_tag
+{
+    static const char id;
+};
+
+template <class TIterator>
+const char any_iterator_tag<TIterator>::id = 0;
+
+template <class TValue>
+class any_iterator : public linq_iterator_traits<TValue>
+{
+private:
+    static constexpr std::size_t buffer_size = 6 * sizeof(void*);
+    using buffer_type = std::aligned_storage_t<buffer_size, alignof(std::max_align_t)>;
+
+    class any_base
+    {
+        using self = any_base;
+    public:
+        using value_type = TValue;
+        virtual ~any_base() = default;
+        virtual self* clone_to(void* buffer) const = 0;
+        virtual self* move_to(void* buffer) noexcept = 0;
+        virtual void destroy() noexcept = 0;
+        virtual self* operator++() = 0;
+        virtual value_type operator*() const = 0;
+        virtual bool operator==(const self& other) const = 0;
+        virtual bool batchable() const noexcept = 0;
+        virtual std::size_t next_batch(value_type* buffer, std::size_t count, const self& end) = 0;
+    };
+
+    template <class TIterator>
+    class any_content : public any_base
+    {
+        using self = any_content<TIterator>;
+        using base = any_base;
+        TIterator _iter;
+    public:
+        using value_type = typename base::value_type;
+
+        //iterators that fit the inline buffer and move without throwing are stored in place
+        static constexpr bool is_inline()
+        {
+            return sizeof(self) <= buffer_size &&
+                alignof(self) <= alignof(buffer_type) &&
+                std::is_nothrow_move_constructible<TIterator>::value;
+        }
+
+        template <class TArg>
+        static base* create(void* buffer, TArg&& iter)
+        {
+            if (is_inline())
+            {
+                return ::new(buffer) self(std::forward<TArg>(iter));
+            }
+            return new self(std::forward<TArg>(iter));
+        }
+
+        explicit any_content(const TIterator& iter)
+            : _iter(iter)
+        {
+        }
+
+        explicit any_content(TIterator&& iter)
+            : _iter(std::move(iter))
+        {
+        }
+
+        base* clone_to(void* buffer) const override
+        {
+            return create(buffer, _iter);
+        }
+
+        base* move_to(void* buffer) noexcept override
+        {
+            if (!is_inline())
+            {
+                return this;
+            }
+            auto moved = ::new(buffer) self(std::move(_iter));
+            this->~self();
+            return moved;
+        }
+
+        void destroy() noexcept override
+        {
+            if (is_inline())
+            {
+                this->~self();
+            }
+            else
+            {
+                delete this;
+            }
+        }
+
+        self* operator++() override
+        {
+            ++_iter;
+            return this;
+        }
+
+        value_type operator*() const override
+        {
+            return *_iter;
+        }
+
+        //only called after the type tags matched, so the downcast is safe
+        bool operator==(const base& other) const override
+        {
+            return _iter == static_cast<const self&>(other)._iter;
+        }
+
+        //input iterators may overwrite the current element on ++, so only forward ones are copied ahead
+        bool batchable() const noexcept override
+        {
+            return std::is_base_of<std::forward_iterator_tag, iterator_category_t<TIterator>>::value;
+        }
+
+        std::size_t next_batch(value_type* buffer, std::size_t count, const base& end) override
+        {
+            const auto& last = static_cast<const self&>(end)._iter;
+            std::size_t n = 0;
+            try
+            {
+                for (; n != count && _iter != last; ++n, ++_iter)
+                {
+                    ::new(buffer + n) value_type(*_iter);
+                }
+            }
+            catch (...)
+            {
+                destroy_batch(buffer, n);
+                throw;
+            }
+            return n;
+        }
+    };
+
+    static void destroy_batch(TValue* buffer, std::size_t count) noexcept
+    {
+        for (std::size_t i = 0; i != count; i++)
+        {
+            buffer[i].~TValue();
+        }
+    }
+
+    using self = any_iterator<TValue>;
+
+    buffer_type _buffer;
+    any_base* _iter;
+    const void* _tag;
+
+    void reset() noexcept
+    {
+        if (_iter)
+        {
+            _iter->destroy();
+            _iter = nullptr;
+            _tag = nullptr;
+        }
+    }
+
+public:
+
+    using traits = linq_iterator_traits<TValue>;
+    using value_type = typename traits::value_type;
+    using pointer = typename traits::pointer;
+    using reference = typename traits::reference;
+    using difference_type = typename traits::difference_type;
+    using iterator_category = typename traits::iterator_category;
+
+    any_iterator() noexcept
+        : _iter(nullptr)
+        , _tag(nullptr)
+    {
+    }
+
+    template <class TIterator, std::enable_if_t<!std::is_same<std::decay_t<TIterator>, self>::value>* = nullptr>
+    any_iterator(TIterator&& iter)
+        : _iter(any_content<std::decay_t<TIterator>>::create(&_buffer, std::forward<TIterator>(iter)))
+        , _tag(&any_iterator_tag<std::decay_t<TIterator>>::id)
+    {
+    }
+
+    any_iterator(const self& other)
+        : _iter(other._iter ? other._iter->clone_to(&_buffer) : nullptr)
+        , _tag(other._tag)
+    {
+    }
+
+    any_iterator(self&& other) noexcept
+        : _iter(other._iter ? other._iter->move_to(&_buffer) : nullptr)
+        , _tag(other._tag)
+    {
+        other._iter = nullptr;
+        other._tag = nullptr;
+    }
+
+    self& operator=(const self& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            _iter = other._iter ? other._iter->clone_to(&_buffer) : nullptr;
+            _tag = other._tag;
+        }
+        return *this;
+    }
+
+    self& operator=(self&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            _iter = other._iter ? other._iter->move_to(&_buffer) : nullptr;
+            _tag = other._tag;
+            other._iter = nullptr;
+            other._tag = nullptr;
+        }
+        return *this;
+    }
+
+    ~any_iterator()
+    {
+        reset();
+    }
+
+    self& operator++()
+    {
+        ++(*_iter);
+        return *this;
+    }
+
+    value_type operator*() const
+    {
+        return **_iter;
+    }
+
+    bool operator==(const self& other) const
+    {
+        if (_tag != other._tag)
+        {
+            return false;
+        }
+        return !_iter || (*_iter) == (*other._iter);
+    }
+
+    bool operator!=(const self& other) const
+    {
+        return !((*this) == other);
+    }
+
+    //elements are pulled batch_size at a time, paying one virtual call per batch instead of three per element
+    static constexpr std::size_t batch_size = std::max<std::size_t>(1, std::min<std::size_t>(64, 2048 / sizeof(value_type)));
+
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        if (!_iter || _tag != end._tag || !_iter->batchable())
+        {
+            for (; *this != end; ++(*this))
+            {
+                if (!sink(**this))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        std::aligned_storage_t<sizeof(value_type), alignof(value_type)> storage[batch_size];
+        auto buffer = reinterpret_cast<value_type*>(storage);
+        while (std::size_t n = _iter->next_batch(buffer, batch_size, *end._iter))
+        {
+            struct batch_guard
+            {
+                value_type* buffer;
+                std::size_t count;
+
+                ~batch_guard()
+                {
+                    destroy_batch(buffer, count);
+                }
+            } guard{buffer, n};
+
+            for (std::size_t i = 0; i != n; i++)
+            {
+                if (!sink(std::move(buffer[i])))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+template <class TFunction, bool Descending>
+struct order_key
+{
+    TFunction selector;
+};
+
+template <class TValue, class TKeySelectors>
+struct order_keys;
+
+template <class TValue, class... TFunctions, bool... Descendings>
+struct order_keys<TValue, std::tuple<order_key<TFunctions, Descendings>...>>
+{
+    using type = std::tuple<std::decay_t<decltype(std::declval<const TFunctions&>()(std::declval<const TValue&>()))>...>;
+};
+
+/*
+ * shared state of an ordered collection: the source range and the key selectors.
+ * the source is gathered and sorted on first access, so chaining then_by sorts only once.
+ */
+template <class TIterator, class TKeySelectors>
+class order_by_state
+{
+public:
+    using value_type = deref_iter_t<TIterator>;
+    using key_type = typename order_keys<value_type, TKeySelectors>::type;
+
+private:
+    struct entry
+    {
+        key_type keys;
+        value_type value;
+    };
+
+    TIterator _begin;
+    TIterator _end;
+    TKeySelectors _selectors;
+    //only the first _limit entries of the sorted sequence are kept
+    std::size_t _limit;
+    arena_vector<entry> _entries;
+    std::once_flag _sorted;
+
+    template <std::size_t... Is>
+    key_type make_keys(const value_type& value, std::index_sequence<Is...>) const
+    {
+        return key_type{std::get<Is>(_selectors).selector(value)...};
+    }
+
+    template <std::size_t I>
+    static bool key_less(const key_type&, const key_type&, std::integral_constant<std::size_t, I>, std::false_type)
+    {
+        return false;
+    }
+
+    template <std::size_t I>
+    static bool key_less(const key_type& a, const key_type& b, std::integral_constant<std::size_t, I>, std::true_type)
+    {
+        using selector_type = std::tuple_element_t<I, TKeySelectors>;
+        const auto& x = std::get<I>(a);
+        const auto& y = std::get<I>(b);
+        if (is_descending(static_cast<selector_type*>(nullptr)) ? y < x : x < y)
+        {
+            return true;
+        }
+        if (is_descending(static_cast<selector_type*>(nullptr)) ? x < y : y < x)
+        {
+            return false;
+        }
+        return key_less(a, b, std::integral_constant<std::size_t, I + 1>{},
+                        std::integral_constant<bool, (I + 1 < std::tuple_size<key_type>::value)>{});
+    }
+
+    template <class TFunction, bool Descending>
+    static constexpr bool is_descending(order_key<TFunction, Descending>*)
+    {
+        return Descending;
+    }
+
+    static bool entry_less(const entry& a, const entry& b)
+    {
+        return key_less(a.keys, b.keys, std::integral_constant<std::size_t, 0>{}, std::true_type{});
+    }
+
+    /*
+     * keeps the _limit smallest entries in a max heap, so the memory stays O(limit).
+     * Elements are numbered in source order to break ties the way a stable sort would.
+     */
+    void select_smallest()
+    {
+        using numbered_entry = std::pair<entry, std::size_t>;
+        auto before = [](const numbered_entry& a, const numbered_entry& b)
+            {
+                return entry_less(a.first, b.first) || (!entry_less(b.first, a.first) && a.second < b.second);
+            };
+
+        arena_vector<numbered_entry> heap;
+        heap.reserve(_limit);
+        std::size_t index = 0;
+        auto it = _begin;
+        linq_push(it, _end, [this, &heap, &index, &before](const value_type& value)
+                  {
+                      auto keys = make_keys(value, std::make_index_sequence<std::tuple_size<key_type>::value>{});
+                      if (heap.size() < _limit)
+                      {
+                          heap.emplace_back(entry{std::move(keys), value}, index++);
+                          std::push_heap(heap.begin(), heap.end(), before);
+                      }
+                      //a later element has to be strictly smaller to replace the largest one kept
+                      else if (key_less(keys, heap.front().first.keys, std::integral_constant<std::size_t, 0>{}, std::true_type{}))
+                      {
+                          std::pop_heap(heap.begin(), heap.end(), before);
+                          heap.back() = numbered_entry(entry{std::move(keys), value}, index++);
+                          std::push_heap(heap.begin(), heap.end(), before);
+                      }
+                      else
+                      {
+                          index++;
+                      }
+                      return true;
+                  });
+        std::sort_heap(heap.begin(), heap.end(), before);
+        _entries.reserve(heap.size());
+        for (auto& numbered : heap)
+        {
+            _entries.push_back(std::move(numbered.first));
+        }
+    }
+
+    void sort()
+    {
+        if (_limit != npos)
+        {
+            if (_limit != 0)
+            {
+                select_smallest();
+            }
+            return;
+        }
+        _entries.reserve(is_random_access<TIterator>::value ? static_cast<std::size_t>(std::distance(_begin, _end)) : 0);
+        auto it = _begin;
+        linq_push(it, _end, [this](const value_type& value)
+                  {
+                      _entries.push_back(entry{make_keys(value, std::make_index_sequence<std::tuple_size<key_type>::value>{}), value});
+                      return true;
+                  });
+        std::stable_sort(_entries.begin(), _entries.end(), entry_less);
+    }
+
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    order_by_state(const TIterator& begin, const TIterator& end, const TKeySelectors& selectors, std::size_t limit = npos)
+        : _begin(begin)
+        , _end(end)
+        , _selectors(selectors)
+        , _limit(limit)
+    {
+    }
+
+    std::size_t limit() const
+    {
+        return _limit;
+    }
+
+    const TIterator& source_begin() const
+    {
+        return _begin;
+    }
+
+    const TIterator& source_end() const
+    {
+        return _end;
+    }
+
+    const TKeySelectors& selectors() const
+    {
+        return _selectors;
+    }
+
+    const arena_vector<entry>& entries()
+    {
+        std::call_once(_sorted, [this]()
+                       {
+                           sort();
+                       });
+        return _entries;
+    }
+};
+
+template <class TState>
+class order_by_iterator : public linq_iterator_traits<const typename TState::value_type&, std::random_access_iterator_tag>
+{
+private:
+    using self = order_by_iterator<TState>;
+    using traits = linq_iterator_traits<const typename TState::value_type&, std::random_access_iterator_tag>;
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    std::shared_ptr<TState> _state;
+    //the end iterator is created before the size is known, it is resolved on first use
+    std::size_t _index;
+
+    std::size_t position() const
+    {
+        return _index == npos ? _state->entries().size() : _index;
+    }
+
+public:
+    using value_type = typename traits::value_type;
+    using pointer = typename traits::pointer;
+    using reference = typename traits::reference;
+    using difference_type = typename traits::difference_type;
+    using iterator_category = typename traits::iterator_category;
+
+    order_by_iterator() = default;
+
+    order_by_iterator(const std::shared_ptr<TState>& state, bool is_end)
+        : _state(state)
+        , _index(is_end ? npos : 0)
+    {
+    }
+
+    self& operator++()
+    {
+        _index = position() + 1;
+        return *this;
+    }
+
+    self& operator--()
+    {
+        _index = position() - 1;
+        return *this;
+    }
+
+    self& operator+=(difference_type n)
+    {
+        _index = position() + n;
+        return *this;
+    }
+
+    self& operator-=(difference_type n)
+    {
+        _index = position() - n;
+        return *this;
+    }
+
+    difference_type operator-(const self& other) const
+    {
+        return static_cast<difference_type>(position()) - static_cast<difference_type>(other.position());
+    }
+
+    reference operator*() const
+    {
+        return _state->entries()[_index].value;
+    }
+
+    bool operator==(const self& other) const
+    {
+        return position() == other.position();
+    }
+
+    bool operator!=(const self& other) const
+    {
+        return !((*this) == other);
+    }
+
+    bool operator<(const self& other) const
+    {
+        return position() < other.position();
+    }
+
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        const auto& entries = _state->entries();
+        for (auto last = end.position(); _index != last; ++_index)
+        {
+            if (!sink(entries[_index].value))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+//operations of the reduction kernels, apply is the scalar version used by every other path
+struct simd_sum
+{
+    template <class T>
+    static auto apply(const T& x, const T& y)
+    {
+        return x + y;
+    }
+};
+
+struct simd_min
+{
+    template <class T>
+    static auto apply(const T& x, const T& y)
+    {
+        return x < y ? x : y;
+    }
+};
+
+struct simd_max
+{
+    template <class T>
+    static auto apply(const T& x, const T& y)
+    {
+        return x > y ? x : y;
+    }
+};
+
+//lane type a kernel works on, void if the type has no kernel
+template <class T, class = void>
+struct simd_element
+{
+    using type = void;
+};
+
+template <class T>
+struct simd_element<T, std::enable_if_t<std::is_integral<T>::value && std::is_signed<T>::value && sizeof(T) == 4>>
+{
+    using type = std::int32_t;
+};
+
+template <class T>
+struct simd_element<T, std::enable_if_t<std::is_integral<T>::value && std::is_signed<T>::value && sizeof(T) == 8>>
+{
+    using type = std::int64_t;
+};
+
+template <>
+struct simd_element<float>
+{
+    using type = float;
+};
+
+template <>
+struct simd_element<double>
+{
+    using type = double;
+};
+
+template <class TIterator, class T = std::decay_t<deref_iter_t<TIterator>>>
+struct is_contiguous_iterator : std::integral_constant<bool,
+                                                       std::is_pointer<TIterator>::value ||
+                                                       std::is_same<TIterator, typename std::vector<T>::iterator>::value ||
+                                                       std::is_same<TIterator, typename std::vector<T>::const_iterator>::value>
+{
+};
+
+//boxed containers and mapped files are as contiguous as the iterators they wrap
+template <class TContainer, class T>
+struct is_contiguous_iterator<boxed_container_iterator<TContainer>, T>
+    : is_contiguous_iterator<typename boxed_container_iterator<TContainer>::iterator_type, T>
+{
+};
+
+template <class TIterator, class T = std::decay_t<deref_iter_t<TIterator>>>
+struct is_simd_source : std::conditional_t<std::is_void<typename simd_element<T>::type>::value,
+                                           std::false_type,
+                                           is_contiguous_iterator<TIterator>>
+{
+};
+
+template <class TOp, class T>
+T simd_scalar_reduce(const T* first, std::size_t count)
+{
+    T result = first[0];
+    for (std::size_t i = 1; i < count; i++)
+    {
+        result = TOp::apply(result, first[i]);
+    }
+    return result;
+}
+
+#ifdef PL_LINQ_SIMD_X86
+
+enum class simd_level
+{
+    scalar,
+    sse2,
+    avx2,
+    avx512,
+};
+
+inline simd_level detect_simd_level()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    auto max_leaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool os_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0;
+    auto xcr0 = os_avx ? _xgetbv(0) : 0;
+    os_avx = os_avx && (xcr0 & 0x6) == 0x6;
+    bool os_avx512 = os_avx && (xcr0 & 0xe0) == 0xe0;
+    bool avx2 = false, avx512 = false;
+    if (max_leaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = os_avx && (info[1] & (1 << 5)) != 0;
+        avx512 = os_avx512 && (info[1] & (1 << 16)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    bool sse2 = __builtin_cpu_supports("sse2") != 0;
+    bool avx2 = __builtin_cpu_supports("avx2") != 0;
+    bool avx512 = __builtin_cpu_supports("avx512f") != 0;
+#endif
+#ifdef PL_LINQ_SIMD_AVX512
+    if (avx512)
+    {
+        return simd_level::avx512;
+    }
+#else
+    (void)avx512;
+#endif
+    return avx2 ? simd_level::avx2 : sse2 ? simd_level::sse2 : simd_level::scalar;
+}
+
+inline simd_level current_simd_level()
+{
+    static const simd_level level = detect_simd_level();
+    return level;
+}
+
+/*
+ * one lanes struct per instruction set and lane type: vector type, width and operations.
+ * Kernels combine four vectors per step to hide the latency of the vector operation.
+ */
+#define PL_LINQ_SIMD_KERNEL(name, isa)                                                                \
+template <class TLanes, class TOp, class T>                                                           \
+PL_LINQ_TARGET(isa) T name(const T* first, std::size_t count)                                         \
+{                                                                                                     \
+    using vector = typename TLanes::vector;                                                           \
+    const std::size_t width = TLanes::width;                                                          \
+    if (count < 4 * width)                                                                            \
+    {                                                                                                 \
+        return simd_scalar_reduce<TOp>(first, count);                                                 \
+    }                                                                                                 \
+    vector acc0 = TLanes::load(first);                                                                \
+    vector acc1 = TLanes::load(first + width);                                                        \
+    vector acc2 = TLanes::load(first + 2 * width);                                                    \
+    vector acc3 = TLanes::load(first + 3 * width);                                                    \
+    std::size_t i = 4 * width;                                                                        \
+    for (; i + 4 * width <= count; i += 4 * width)                                                    \
+    {                                                                                                 \
+        acc0 = TLanes::apply(TOp(), acc0, TLanes::load(first + i));                                   \
+        acc1 = TLanes::apply(TOp(), acc1, TLanes::load(first + i + width));                           \
+        acc2 = TLanes::apply(TOp(), acc2, TLanes::load(first + i + 2 * width));                       \
+        acc3 = TLanes::apply(TOp(), acc3, TLanes::load(first + i + 3 * width));                       \
+    }                                                                                                 \
+    acc0 = TLanes::apply(TOp(), TLanes::apply(TOp(), acc0, acc1), TLanes::apply(TOp(), acc2, acc3));  \
+    T lanes[TLanes::width];                                                                           \
+    TLanes::store(lanes, acc0);                                                                       \
+    T result = lanes[0];                                                                              \
+    for (std::size_t j = 1; j < width; j++)                                                           \
+    {                                                                                                 \
+        result = TOp::apply(result, lanes[j]);                                                        \
+    }                                                                                                 \
+    for (; i < count; i++)                                                                            \
+    {                                                                                                 \
+        result = TOp::apply(result, first[i]);                                                        \
+    }                                                                                                 \
+    return result;                                                                                    \
+}
+
+template <class T>
+struct simd_sse2_lanes;
+
+template <>
+struct simd_sse2_lanes<std::int32_t>
+{
+    using vector = __m128i;
+    static const std::size_t width = 4;
+
+    PL_LINQ_TARGET("sse2") static vector load(const void* p) { return _mm_loadu_si128(static_cast<const __m128i*>(p)); }
+    PL_LINQ_TARGET("sse2") static void store(void* p, vector v) { _mm_storeu_si128(static_cast<__m128i*>(p), v); }
+    PL_LINQ_TARGET("sse2") static vector select(vector mask, vector a, vector b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+    PL_LINQ_TARGET("sse2") static vector apply(simd_sum, vector a, vector b) { return _mm_add_epi32(a, b); }
+    PL_LINQ_TARGET("sse2") static vector apply(simd_min, vector a, vector b) { return select(_mm_cmplt_epi32(a, b), a, b); }
+    PL_LINQ_TARGET("sse2") static vector apply(simd_max, vector a, vector b) { return select(_mm_cmpgt_epi32(a, b), a, b); }
+};
+
+template <>
+struct simd_sse2_lanes<std::int64_t>
+{
+    using vector = __m128i;
+    static const std::size_t width = 2;
+
+    PL_LINQ_TARGET("sse2") static vector load(const void* p) { return _mm_loadu_si128(static_cast<const __m128i*>(p)); }
+    PL_LINQ_TARGET("sse2") static void store(void* p, vector v) { _mm_storeu_si128(static_cast<__m128i*>(p), v); }
+    PL_LINQ_TARGET("sse2") static vector apply(simd_sum, vector a, vector b) { return _mm_add_epi64(a, b); }
+
+    //SSE2 has no 64 bit comparison, compare the two lanes one by one
+    template <class TOp>
+    PL_LINQ_TARGET("sse2") static vector apply(TOp, vector a, vector b)
+    {
+        std::int64_t x[2], y[2];
+        store(x, a);
+        store(y, b);
+        x[0] = TOp::apply(x[0], y[0]);
+        x[1] = TOp::apply(x[1], y[1]);
+        return load(x);
+    }
+};
+
+template <>
+struct simd_sse2_lanes<float>
+{
+    using vector = __m128;
+    static const std::size_t width = 4;
+
+    PL_LINQ_TARGET("sse2") static vector load(const void* p) { return _mm_loadu_ps(static_cast<const float*>(p)); }
+    PL_LINQ_TARGET("sse2") static void store(void* p, vector v) { _mm_storeu_ps(static_cast<float*>(p), v); }
+    PL_LINQ_TARGET("sse2") static vector apply(simd_sum, vector a, vector b) { return _mm_add_ps(a, b); }
+    PL_LINQ_TARGET("sse2") static vector apply(simd_min, vector a, vector b) { return _mm_min_ps(a, b); }
+    PL_LINQ_TARGET("sse2") static vector apply(simd_max, vector a, vector b) { return _mm_max_ps(a, b); }
+};
+
+template <>
+struct simd_sse2_lanes<double>
+{
+    using vector = __m128d;
+    static const std::size_t width = 2;
+
+    PL_LINQ_TARGET("sse2") static vector load(const void* p) { return _mm_loadu_pd(static_cast<const double*>(p)); }
+    PL_LINQ_TARGET("sse2") static void store(void* p, vector v) { _mm_storeu_pd(static_cast<double*>(p), v); }
+    PL_LINQ_TARGET("sse2") static vector apply(simd_sum, vector a, vector b) { return _mm_add_pd(a, b); }
+    PL_LINQ_TARGET("sse2") static vector apply(simd_min, vector a, vector b) { return _mm_min_pd(a, b); }
+    PL_LINQ_TARGET("sse2") static vector apply(simd_max, vector a, vector b) { return _mm_max_pd(a, b); }
+};
+
+template <class T>
+struct simd_avx2_lanes;
+
+template <>
+struct simd_avx2_lanes<std::int32_t>
+{
+    using vector = __m256i;
+    static const std::size_t width = 8;
+
+    PL_LINQ_TARGET("avx2") static vector load(const void* p) { return _mm256_loadu_si256(static_cast<const __m256i*>(p)); }
+    PL_LINQ_TARGET("avx2") static void store(void* p, vector v) { _mm256_storeu_si256(static_cast<__m256i*>(p), v); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_sum, vector a, vector b) { return _mm256_add_epi32(a, b); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_min, vector a, vector b) { return _mm256_min_epi32(a, b); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_max, vector a, vector b) { return _mm256_max_epi32(a, b); }
+};
+
+template <>
+struct simd_avx2_lanes<std::int64_t>
+{
+    using vector = __m256i;
+    static const std::size_t width = 4;
+
+    PL_LINQ_TARGET("avx2") static vector load(const void* p) { return _mm256_loadu_si256(static_cast<const __m256i*>(p)); }
+    PL_LINQ_TARGET("avx2") static void store(void* p, vector v) { _mm256_storeu_si256(static_cast<__m256i*>(p), v); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_sum, vector a, vector b) { return _mm256_add_epi64(a, b); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_min, vector a, vector b) { return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(b, a)); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_max, vector a, vector b) { return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b)); }
+};
+
+template <>
+struct simd_avx2_lanes<float>
+{
+    using vector = __m256;
+    static const std::size_t width = 8;
+
+    PL_LINQ_TARGET("avx2") static vector load(const void* p) { return _mm256_loadu_ps(static_cast<const float*>(p)); }
+    PL_LINQ_TARGET("avx2") static void store(void* p, vector v) { _mm256_storeu_ps(static_cast<float*>(p), v); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_sum, vector a, vector b) { return _mm256_add_ps(a, b); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_min, vector a, vector b) { return _mm256_min_ps(a, b); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_max, vector a, vector b) { return _mm256_max_ps(a, b); }
+};
+
+template <>
+struct simd_avx2_lanes<double>
+{
+    using vector = __m256d;
+    static const std::size_t width = 4;
+
+    PL_LINQ_TARGET("avx2") static vector load(const void* p) { return _mm256_loadu_pd(static_cast<const double*>(p)); }
+    PL_LINQ_TARGET("avx2") static void store(void* p, vector v) { _mm256_storeu_pd(static_cast<double*>(p), v); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_sum, vector a, vector b) { return _mm256_add_pd(a, b); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_min, vector a, vector b) { return _mm256_min_pd(a, b); }
+    PL_LINQ_TARGET("avx2") static vector apply(simd_max, vector a, vector b) { return _mm256_max_pd(a, b); }
+};
+
+PL_LINQ_SIMD_KERNEL(simd_reduce_sse2, "sse2")
+PL_LINQ_SIMD_KERNEL(simd_reduce_avx2, "avx2")
+
+#ifdef PL_LINQ_SIMD_AVX512
+
+//gcc warns about the undefined passthrough vectors inside its own avx512 intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+template <class T>
+struct simd_avx512_lanes;
+
+template <>
+struct simd_avx512_lanes<std::int32_t>
+{
+    using vector = __m512i;
+    static const std::size_t width = 16;
+
+    PL_LINQ_TARGET("avx512f") static vector load(const void* p) { return _mm512_loadu_si512(p); }
+    PL_LINQ_TARGET("avx512f") static void store(void* p, vector v) { _mm512_storeu_si512(p, v); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_sum, vector a, vector b) { return _mm512_add_epi32(a, b); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_min, vector a, vector b) { return _mm512_min_epi32(a, b); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_max, vector a, vector b) { return _mm512_max_epi32(a, b); }
+};
+
+template <>
+struct simd_avx512_lanes<std::int64_t>
+{
+    using vector = __m512i;
+    static const std::size_t width = 8;
+
+    PL_LINQ_TARGET("avx512f") static vector load(const void* p) { return _mm512_loadu_si512(p); }
+    PL_LINQ_TARGET("avx512f") static void store(void* p, vector v) { _mm512_storeu_si512(p, v); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_sum, vector a, vector b) { return _mm512_add_epi64(a, b); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_min, vector a, vector b) { return _mm512_min_epi64(a, b); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_max, vector a, vector b) { return _mm512_max_epi64(a, b); }
+};
+
+template <>
+struct simd_avx512_lanes<float>
+{
+    using vector = __m512;
+    static const std::size_t width = 16;
+
+    PL_LINQ_TARGET("avx512f") static vector load(const void* p) { return _mm512_loadu_ps(p); }
+    PL_LINQ_TARGET("avx512f") static void store(void* p, vector v) { _mm512_storeu_ps(p, v); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_sum, vector a, vector b) { return _mm512_add_ps(a, b); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_min, vector a, vector b) { return _mm512_min_ps(a, b); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_max, vector a, vector b) { return _mm512_max_ps(a, b); }
+};
+
+template <>
+struct simd_avx512_lanes<double>
+{
+    using vector = __m512d;
+    static const std::size_t width = 8;
+
+    PL_LINQ_TARGET("avx512f") static vector load(const void* p) { return _mm512_loadu_pd(p); }
+    PL_LINQ_TARGET("avx512f") static void store(void* p, vector v) { _mm512_storeu_pd(p, v); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_sum, vector a, vector b) { return _mm512_add_pd(a, b); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_min, vector a, vector b) { return _mm512_min_pd(a, b); }
+    PL_LINQ_TARGET("avx512f") static vector apply(simd_max, vector a, vector b) { return _mm512_max_pd(a, b); }
+};
+
+PL_LINQ_SIMD_KERNEL(simd_reduce_avx512, "avx512f")
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+#undef PL_LINQ_SIMD_KERNEL
+
+#endif
+
+//reduces count > 0 contiguous elements with the widest kernel the cpu supports
+template <class TOp, class T>
+T simd_reduce(const T* first, std::size_t count)
+{
+#ifdef PL_LINQ_SIMD_X86
+    using element = typename simd_element<T>::type;
+    switch (current_simd_level())
+    {
+#ifdef PL_LINQ_SIMD_AVX512
+    case simd_level::avx512:
+        return simd_reduce_avx512<simd_avx512_lanes<element>, TOp>(first, count);
+#endif
+    case simd_level::avx2:
+        return simd_reduce_avx2<simd_avx2_lanes<element>, TOp>(first, count);
+    case simd_level::sse2:
+        return simd_reduce_sse2<simd_sse2_lanes<element>, TOp>(first, count);
+    default:
+        break;
+    }
+#endif
+    return simd_scalar_reduce<TOp>(first, count);
+}
+
+inline const char* scalar_find_any(const char* first, const char* last, char a, char b)
+{
+    for (; first != last && *first != a && *first != b; ++first)
+    {
+        //nothing
+    }
+    return first;
+}
+
+#ifdef PL_LINQ_SIMD_X86
+//position of the lowest set bit of a non-zero mask
+inline unsigned simd_first_bit(std::uint32_t mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+PL_LINQ_TARGET("sse2") inline const char* simd_find_any_sse2(const char* first, const char* last, char a, char b)
+{
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; last - first >= 16; first += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+        if (mask != 0)
+        {
+            return first + simd_first_bit(static_cast<std::uint32_t>(mask));
+        }
+    }
+    return scalar_find_any(first, last, a, b);
+}
+
+PL_LINQ_TARGET("avx2") inline const char* simd_find_any_avx2(const char* first, const char* last, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; last - first >= 32; first += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb)));
+        if (mask != 0)
+        {
+            return first + simd_first_bit(static_cast<std::uint32_t>(mask));
+        }
+    }
+    return simd_find_any_sse2(first, last, a, b);
+}
+#endif
+
+//first occurrence of a or b in [first, last), 16 or 32 characters per step
+inline const char* find_any(const char* first, const char* last, char a, char b)
+{
+#ifdef PL_LINQ_SIMD_X86
+    switch (current_simd_level())
+    {
+    case simd_level::avx512:
+    case simd_level::avx2:
+        return simd_find_any_avx2(first, last, a, b);
+    case simd_level::sse2:
+        return simd_find_any_sse2(first, last, a, b);
+    default:
+        break;
+    }
+#endif
+    return scalar_find_any(first, last, a, b);
+}
+
+struct csv_format
+{
+    char delimiter = ',';
+    //columns can only be selected by name when the first record is a header
+    bool header = true;
+    std::size_t block_size = 64 * 1024;
+};
+
+//maps one column of a delimited file to a member of the row type
+template <class TRow, class TField>
+struct csv_field
+{
+    //empty when the column is selected by index
+    std::string name;
+    std::size_t index;
+    TField TRow::* member;
+};
+
+template <class TRow, class TField>
+csv_field<TRow, TField> csv_column(std::size_t index, TField TRow::* member)
+{
+    return {std::string(), index, member};
+}
+
+template <class TRow, class TField>
+csv_field<TRow, TField> csv_column(std::string name, TField TRow::* member)
+{
+    return {std::move(name), 0, member};
+}
+
+inline void csv_parse(const char* first, const char* last, std::string& value)
+{
+    value.assign(first, last);
+}
+
+inline void csv_parse(const char* first, const char* last, bool& value)
+{
+    std::size_t size = static_cast<std::size_t>(last - first);
+    if ((size == 1 && *first == '1') || (size == 4 && std::equal(first, last, "true")))
+    {
+        value = true;
+    }
+    else if ((size == 1 && *first == '0') || (size == 5 && std::equal(first, last, "false")))
+    {
+        value = false;
+    }
+    else
+    {
+        throw csv_format_error("cannot parse '" + std::string(first, last) + "' as bool");
+    }
+}
+
+template <class T, std::enable_if_t<std::is_integral<T>::value>* = nullptr>
+void csv_parse(const char* first, const char* last, T& value)
+{
+    using unsigned_type = std::make_unsigned_t<T>;
+    const char* text = first;
+    bool negative = std::is_signed<T>::value && *first == '-';
+    if (negative || *first == '+')
+    {
+        ++first;
+    }
+    //the magnitude of the most negative value is one more than max
+    auto limit = static_cast<unsigned_type>(std::numeric_limits<T>::max()) + (negative ? 1u : 0u);
+    unsigned_type result = 0;
+    bool valid = first != last;
+    for (; valid && first != last; ++first)
+    {
+        auto digit = static_cast<unsigned>(*first - '0');
+        valid = digit <= 9 && result <= (limit - digit) / 10;
+        result = static_cast<unsigned_type>(result * 10 + digit);
+    }
+    if (!valid)
+    {
+        throw csv_format_error("cannot parse '" + std::string(text, last) + "' as an integer");
+    }
+    value = negative ? static_cast<T>(0 - result) : static_cast<T>(result);
+}
+
+template <class T, std::enable_if_t<std::is_floating_point<T>::value>* = nullptr>
+void csv_parse(const char* first, const char* last, T& value)
+{
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    auto result = std::from_chars(first, last, value);
+    if (result.ec != std::errc() || result.ptr != last)
+    {
+        throw csv_format_error("cannot parse '" + std::string(first, last) + "' as a number");
+    }
+#else
+    //strtod needs a terminated string and follows the C locale of the program
+    std::string text(first, last);
+    char* end = nullptr;
+    auto result = std::strtod(text.c_str(), &end);
+    if (end != text.c_str() + text.size())
+    {
+        throw csv_format_error("cannot parse '" + text + "' as a number");
+    }
+    value = static_cast<T>(result);
+#endif
+}
+
+/*
+ * parses a delimited file record by record into one reused row, converting only the mapped columns.
+ * Field boundaries are found with find_any, quoted fields may contain delimiters, line breaks and doubled quotes,
+ * empty fields leave the member default constructed
+ */
+template <class TRow, class... TFields>
+class csv_reader
+{
+    static_assert(sizeof...(TFields) > 0, "map at least one column");
+
+private:
+    using self = csv_reader<TRow, TFields...>;
+    using fields_type = std::tuple<csv_field<TRow, TFields>...>;
+    using assign_function = void (*)(const fields_type&, TRow&, const char*, const char*);
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    std::unique_ptr<std::istream> _stream;
+    std::string _path;
+    csv_format _format;
+    fields_type _fields;
+    //the conversion of every column up to the last mapped one, null for columns that are skipped
+    std::vector<assign_function> _columns;
+    std::vector<char> _buffer;
+    std::size_t _next;
+    std::size_t _filled;
+    bool _eof;
+    std::string _unescaped;
+    TRow _row;
+    //blank lines are records only in files with a single column
+    bool _keep_blank;
+    bool _started;
+    bool _done;
+
+    template <std::size_t I>
+    static void assign(const fields_type& fields, TRow& row, const char* first, const char* last)
+    {
+        csv_parse(first, last, row.*(std::get<I>(fields).member));
+    }
+
+    void refill()
+    {
+        std::size_t rest = _filled - _next;
+        if (rest != 0 && _next != 0)
+        {
+            std::memmove(_buffer.data(), _buffer.data() + _next, rest);
+        }
+        if (rest == _buffer.size())
+        {
+            _buffer.resize(_buffer.size() * 2);
+        }
+        _next = 0;
+        _filled = rest;
+
+        _stream->read(_buffer.data() + rest, static_cast<std::streamsize>(_buffer.size() - rest));
+        _filled += static_cast<std::size_t>(_stream->gcount());
+        _eof = !*_stream;
+    }
+
+    /*
+     * calls visit(column, first, last, escaped) for the columns up to last_column of the record at _next
+     * and throws if the record ends before last_column, unless last_column is npos.
+     * Returns false without consuming anything when the buffer ends before the record does
+     */
+    template <class TVisit>
+    bool parse_record(const TVisit& visit, std::size_t last_column)
+    {
+        const char* p = _buffer.data() + _next;
+        const char* end = _buffer.data() + _filled;
+        const char delimiter = _format.delimiter;
+        for (std::size_t column = 0;; column++)
+        {
+            if (column > last_column)
+            {
+                return skip_record(p, end);
+            }
+
+            const char* first = p;
+            const char* last = nullptr;
+            bool escaped = false;
+            if (p != end && *p == '"')
+            {
+                first = ++p;
+                for (;;)
+                {
+                    p = static_cast<const char*>(std::memchr(p, '"', static_cast<std::size_t>(end - p)));
+                    if (!p)
+                    {
+                        if (_eof)
+                        {
+                            throw csv_format_error("unterminated quoted field in " + _path);
+                        }
+                        return false;
+                    }
+                    if (p + 1 == end && !_eof)
+                    {
+                        return false;
+                    }
+                    if (p + 1 == end || p[1] != '"')
+                    {
+                        break;
+                    }
+                    escaped = true;
+                    p += 2;
+                }
+                last = p++;
+                if (p != end && *p == '\r')
+                {
+                    if (p + 1 == end && !_eof)
+                    {
+                        return false;
+                    }
+                    ++p;
+                }
+                if (p != end && *p != delimiter && *p != '\n')
+                {
+                    throw csv_format_error("unexpected character after a quoted field in " + _path);
+                }
+            }
+            else
+            {
+                p = find_any(p, end, delimiter, '\n');
+                if (p == end && !_eof)
+                {
+                    return false;
+                }
+                last = p != first && p[-1] == '\r' && (p == end || *p == '\n') ? p - 1 : p;
+            }
+
+            visit(column, first, last, escaped);
+            if (p == end || *p == '\n')
+            {
+                if (column < last_column && last_column != npos)
+                {
+                    throw csv_format_error("a record of " + _path + " has no column " + std::to_string(last_column));
+                }
+                _next = static_cast<std::size_t>(p - _buffer.data()) + (p == end ? 0 : 1);
+                return true;
+            }
+            ++p;
+        }
+    }
+
+    //moves past the columns after the last mapped one, only quotes and line breaks matter there
+    bool skip_record(const char* p, const char* end)
+    {
+        for (;;)
+        {
+            p = find_any(p, end, '"', '\n');
+            if (p == end)
+            {
+                if (!_eof)
+                {
+                    return false;
+                }
+                _next = _filled;
+                return true;
+            }
+            if (*p == '\n')
+            {
+                _next = static_cast<std::size_t>(p - _buffer.data()) + 1;
+                return true;
+            }
+            p = static_cast<const char*>(std::memchr(p + 1, '"', static_cast<std::size_t>(end - p - 1)));
+            if (!p)
+            {
+                if (_eof)
+                {
+                    throw csv_format_error("unterminated quoted field in " + _path);
+                }
+                return false;
+            }
+            ++p;
+        }
+    }
+
+    /*
+     * false at the end of the file. With keep_blank a blank line is a record with one empty field,
+     * otherwise it separates records and is skipped
+     */
+    bool find_record(bool keep_blank)
+    {
+        for (;;)
+        {
+            if (_next != _filled && (keep_blank || (_buffer[_next] != '\n' && _buffer[_next] != '\r')))
+            {
+                return true;
+            }
+            if (_next != _filled && _buffer[_next] == '\n')
+            {
+                _next++;
+                continue;
+            }
+            if (_next + 1 < _filled)
+            {
+                //a carriage return only ends a blank line together with its line feed
+                if (_buffer[_next + 1] != '\n')
+                {
+                    return true;
+                }
+                _next += 2;
+                continue;
+            }
+            if (_eof)
+            {
+                _next = _filled;
+                return false;
+            }
+            refill();
+        }
+    }
+
+    template <class TVisit>
+    bool read_record(const TVisit& visit, std::size_t last_column)
+    {
+        if (!find_record(_keep_blank))
+        {
+            return false;
+        }
+        while (!parse_record(visit, last_column))
+        {
+            refill();
+        }
+        return true;
+    }
+
+    bool read_row()
+    {
+        return read_record([this](std::size_t column, const char* first, const char* last, bool escaped)
+                           {
+                               if (column == 0)
+                               {
+                                   _row = TRow();
+                               }
+                               if (first == last || !_columns[column])
+                               {
+                                   return;
+                               }
+                               if (escaped)
+                               {
+                                   _unescaped.clear();
+                                   for (const char* p = first; p != last; ++p)
+                                   {
+                                       _unescaped.push_back(*p);
+                                       p += *p == '"' ? 1 : 0;
+                                   }
+                                   first = _unescaped.data();
+                                   last = first + _unescaped.size();
+                               }
+                               _columns[column](_fields, _row, first, last);
+                           }, _columns.size() - 1);
+    }
+
+    std::vector<std::string> read_header()
+    {
+        std::vector<std::string> names;
+        read_record([&names](std::size_t column, const char* first, const char* last, bool)
+                    {
+                        //a record cut by the end of the buffer is parsed again after the refill
+                        if (column == 0)
+                        {
+                            names.clear();
+                        }
+                        names.emplace_back(first, last);
+                    }, npos);
+        return names;
+    }
+
+    template <class TField>
+    std::size_t column_index(const csv_field<TRow, TField>& field, const std::vector<std::string>& names) const
+    {
+        if (field.name.empty())
+        {
+            return field.index;
+        }
+        auto iter = std::find(names.begin(), names.end(), field.name);
+        if (iter == names.end())
+        {
+            throw csv_format_error("no column named " + field.name + " in " + _path);
+        }
+        return static_cast<std::size_t>(iter - names.begin());
+    }
+
+    template <std::size_t... Is>
+    void bind_columns(std::index_sequence<Is...>)
+    {
+        auto names = _format.header ? read_header() : std::vector<std::string>();
+        std::size_t indices[] = {column_index(std::get<Is>(_fields), names)...};
+        assign_function functions[] = {&self::assign<Is>...};
+        _columns.resize(*std::max_element(std::begin(indices), std::end(indices)) + 1);
+        _keep_blank = _columns.size() == 1 && (!_format.header || names.size() == 1);
+        for (std::size_t i = 0; i != sizeof...(Is); i++)
+        {
+            if (_columns[indices[i]])
+            {
+                throw csv_format_error("column " + std::to_string(indices[i]) + " is mapped twice");
+            }
+            _columns[indices[i]] = functions[i];
+        }
+    }
+
+    //the header is read when the query asks for the first row
+    void start()
+    {
+        if (!_started)
+        {
+            _started = true;
+            bind_columns(std::index_sequence_for<TFields...>{});
+            _done = !read_row();
+        }
+    }
+
+public:
+    using reference = const TRow&;
+
+    csv_reader(const std::string& path, const csv_format& format, const csv_field<TRow, TFields>&... fields)
+        : _stream(new std::ifstream(path, std::ios::in | std::ios::binary))
+        , _path(path)
+        , _format(format)
+        , _fields(fields...)
+        , _buffer(std::max<std::size_t>(format.block_size, 1))
+        , _next(0)
+        , _filled(0)
+        , _eof(false)
+        , _keep_blank(false)
+        , _started(false)
+        , _done(false)
+    {
+        if (!*_stream)
+        {
+            throw file_not_readable("cannot open " + path);
+        }
+        for (const auto& name : {fields.name...})
+        {
+            if (!name.empty() && !format.header)
+            {
+                throw csv_format_error("columns of " + path + " can only be selected by name with a header");
+            }
+        }
+    }
+
+    bool done()
+    {
+        start();
+        return _done;
+    }
+
+    const TRow& current()
+    {
+        start();
+        return _row;
+    }
+
+    void advance()
+    {
+        start();
+        _done = _done || !read_row();
+    }
+};
+
+template <class TIterator>
+class linq_collection;
+
+template <class TIterator, class TKeySelectors>
+class ordered_linq_collection;
+
+template <class T>
+class linq;
+
+class thread_pool;
+
+template <class TPartition, class TStage>
+class parallel_query;
+
+template <class T>
+class optional_holder
+{
+private:
+    using self = optional_holder<T>;
+
+    std::aligned_storage_t<sizeof(T), alignof(T)> _storage;
+    bool _engaged;
+
+public:
+    optional_holder() noexcept
+        : _engaged(false)
+    {
+    }
+
+    optional_holder(const self& other)
+        : _engaged(false)
+    {
+        if (other._engaged)
+        {
+            emplace(other.get());
+        }
+    }
+
+    self& operator=(const self& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other._engaged)
+            {
+                emplace(other.get());
+            }
+        }
+        return *this;
+    }
+
+    ~optional_holder()
+    {
+        reset();
+    }
+
+    template <class... TArgs>
+    T& emplace(TArgs&&... args)
+    {
+        reset();
+        ::new(&_storage) T(std::forward<TArgs>(args)...);
+        _engaged = true;
+        return get();
+    }
+
+    void reset() noexcept
+    {
+        if (_engaged)
+        {
+            get().~T();
+            _engaged = false;
+        }
+    }
+
+    bool has_value() const
+    {
+        return _engaged;
+    }
+
+    T& get()
+    {
+        return *reinterpret_cast<T*>(&_storage);
+    }
+
+    const T& get() const
+    {
+        return *reinterpret_cast<const T*>(&_storage);
+    }
+};
+
+template <class TCollection>
+using is_linq_collection = std::is_base_of<linq_collection<decltype(std::declval<const TCollection&>().begin())>, TCollection>;
+
+/*
+ * current inner range of a select_many_iterator.
+ * linq collections own their state through their iterators, so only the iterators are kept,
+ * other containers are kept alive in a shared_ptr that the iterators point into.
+ */
+template <class TCollection, bool IsLinq = is_linq_collection<TCollection>::value>
+class select_many_range
+{
+public:
+    using iterator = decltype(std::declval<const TCollection&>().begin());
+
+private:
+    iterator _begin;
+    iterator _end;
+
+public:
+    select_many_range()
+        : _begin()
+        , _end()
+    {
+    }
+
+    void load(const TCollection& collection)
+    {
+        _begin = collection.begin();
+        _end = collection.end();
+    }
+
+    //drops the state the inner iterators share with their collection
+    void reset()
+    {
+        _begin = iterator();
+        _end = iterator();
+    }
+
+    iterator& begin()
+    {
+        return _begin;
+    }
+
+    const iterator& begin() const
+    {
+        return _begin;
+    }
+
+    const iterator& end() const
+    {
+        return _end;
+    }
+};
+
+template <class TCollection>
+class select_many_range<TCollection, false>
+{
+public:
+    using iterator = decltype(std::begin(std::declval<const TCollection&>()));
+
+private:
+    std::shared_ptr<const TCollection> _collection;
+    iterator _begin;
+    iterator _end;
+
+public:
+    select_many_range()
+        : _begin()
+        , _end()
+    {
+    }
+
+    void load(TCollection&& collection)
+    {
+        _collection = make_arena_shared<TCollection>(std::move(collection));
+        _begin = std::begin(*_collection);
+        _end = std::end(*_collection);
+    }
+
+    void reset()
+    {
+        _begin = iterator();
+        _end = iterator();
+        _collection.reset();
+    }
+
+    iterator& begin()
+    {
+        return _begin;
+    }
+
+    const iterator& begin() const
+    {
+        return _begin;
+    }
+
+    const iterator& end() const
+    {
+        return _end;
+    }
+};
+
+/*
+ * flattens the collections returned by the selector, holding only the current outer position
+ * and the current inner range, so every element costs O(1) regardless of how many were flattened before
+ */
+template <class TIterator, class TFunction>
+class select_many_iterator
+    : public linq_iterator_traits<deref_iter_t<decltype(std::begin(std::declval<const std::decay_t<decltype(std::declval<const TFunction&>()(std::declval<deref_ref_t<TIterator>>()))>&>()))>,
+                                  weaker_category_t<std::forward_iterator_tag, iterator_category_t<TIterator>>>
+{
+private:
+    using self = select_many_iterator<TIterator, TFunction>;
+    using collection_type = std::decay_t<decltype(std::declval<const TFunction&>()(std::declval<deref_ref_t<TIterator>>()))>;
+    using traits = linq_iterator_traits<deref_iter_t<decltype(std::begin(std::declval<const collection_type&>()))>,
+                                        weaker_category_t<std::forward_iterator_tag, iterator_category_t<TIterator>>>;
+
+    TIterator _iter;
+    sentinel_t<TIterator> _end;
+    function_holder<TFunction> _func;
+    select_many_range<collection_type> _inner;
+
+    //moves the outer iterator to the first element with a non-empty inner range
+    void check_move_iterator()
+    {
+        for (; !linq_at_end(_iter, _end); ++_iter)
+        {
+            _inner.load(_func(*_iter));
+            if (_inner.begin() != _inner.end())
+            {
+                return;
+            }
+        }
+        _inner.reset();
+    }
+
+public:
+    using value_type = typename traits::value_type;
+    using pointer = typename traits::pointer;
+    using reference = typename traits::reference;
+    using difference_type = typename traits::difference_type;
+    using iterator_category = typename traits::iterator_category;
+    using sentinel = sentinel_t<TIterator>;
+
+    select_many_iterator() = default;
+
+    select_many_iterator(TIterator begin, sentinel end, const function_holder<TFunction>& func)
+        : _iter(std::move(begin))
+        , _end(std::move(end))
+        , _func(func)
+    {
+        check_move_iterator();
+    }
+
+    const TIterator& source() const
+    {
+        return _iter;
+    }
+
+    sentinel end_sentinel() const
+    {
+        return linq_sentinel(_iter);
+    }
+
+    //an outer element is only stopped at while its inner range is not empty
+    bool at_end(const sentinel& end) const
+    {
+        return linq_at_end(_iter, end);
+    }
+
+    const TFunction& selector() const
+    {
+        return _func.get();
+    }
+
+    self& operator++()
+    {
+        if (++_inner.begin() == _inner.end())
+        {
+            ++_iter;
+            check_move_iterator();
+        }
+        return *this;
+    }
+
+    reference operator*() const
+    {
+        return *_inner.begin();
+    }
+
+    bool operator==(const self& other) const
+    {
+        return _iter == other._iter && (linq_at_end(_iter, _end) || _inner.begin() == other._inner.begin());
+    }
+
+    bool operator!=(const self& other) const
+    {
+        return !((*this) == other);
+    }
+
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        while (_iter != end._iter)
+        {
+            if (!linq_push(_inner.begin(), _inner.end(), sink))
+            {
+                return false;
+            }
+            ++_iter;
+            check_move_iterator();
+        }
+        return true;
+    }
+};
+
+//one group per key in order of first appearance, found through a hash index
+template <class TKey, class TGroup>
+class hash_groups
+{
+public:
+    using group_type = std::pair<TKey, TGroup>;
+private:
+    arena_unordered_map<TKey, std::size_t> _index;
+    arena_vector<group_type> _groups;
+public:
+    template <class TFactory>
+    TGroup& find_or_add(TKey&& key, const TFactory& make_group)
+    {
+        auto iter = _index.find(key);
+        if (iter != _index.end())
+        {
+            return _groups[iter->second].second;
+        }
+        _index.emplace(key, _groups.size());
+        _groups.emplace_back(std::move(key), make_group());
+        return _groups.back().second;
+    }
+
+    arena_vector<group_type> release()
+    {
+        _index.clear();
+        return std::move(_groups);
+    }
+};
+
+//build side of a hash join, every key maps to the elements sharing it in source order
+template <class TKey, class TValue>
+class hash_join_table
+{
+public:
+    using key_type = TKey;
+    using value_type = TValue;
+    using group_type = arena_vector<TValue>;
+
+private:
+    arena_unordered_map<TKey, group_type> _groups;
+    optional_holder<TValue> _default_value;
+
+public:
+    template <class TIterator, class TFunction>
+    hash_join_table(TIterator begin, const TIterator& end, const TFunction& keySelector)
+    {
+        linq_push(begin, end, [this, &keySelector](const auto& value)
+                  {
+                      _groups[keySelector(value)].push_back(value);
+                      return true;
+                  });
+    }
+
+    const group_type* find(const TKey& key) const
+    {
+        auto iter = _groups.find(key);
+        return iter == _groups.end() ? nullptr : &iter->second;
+    }
+
+    void set_default_value(const TValue& value)
+    {
+        _default_value.emplace(value);
+    }
+
+    const TValue& default_value() const
+    {
+        return _default_value.get();
+    }
+};
+
+/*
+ * probe side of a hash join: streams the probe sequence and emits one row per match.
+ * Outer joins emit the table's default value for probe elements without a match,
+ * Swap puts the build side element before the probe side element in the row.
+ */
+template <class TIterator, class TFunction, class TTable, bool Outer, bool Swap>
+class join_iterator
+    : public linq_iterator_traits<std::conditional_t<Swap,
+                                                     std::tuple<typename TTable::key_type, typename TTable::value_type, deref_iter_t<TIterator>>,
+                                                     std::tuple<typename TTable::key_type, deref_iter_t<TIterator>, typename TTable::value_type>>,
+                                  weaker_category_t<std::forward_iterator_tag, iterator_category_t<TIterator>>>
+{
+private:
+    using self = join_iterator<TIterator, TFunction, TTable, Outer, Swap>;
+    using traits = linq_iterator_traits<std::conditional_t<Swap,
+                                                           std::tuple<typename TTable::key_type, typename TTable::value_type, deref_iter_t<TIterator>>,
+                                                           std::tuple<typename TTable::key_type, deref_iter_t<TIterator>, typename TTable::value_type>>,
+                                        weaker_category_t<std::forward_iterator_tag, iterator_category_t<TIterator>>>;
+    using key_type = typename TTable::key_type;
+    using build_type = typename TTable::value_type;
+
+    TIterator _iter;
+    sentinel_t<TIterator> _end;
+    function_holder<TFunction> _keySelector;
+    std::shared_ptr<const TTable> _table;
+    optional_holder<key_type> _key;
+    //null when an outer join emits the default row for an unmatched probe element
+    const typename TTable::group_type* _group;
+    std::size_t _index;
+
+    void check_move_iterator()
+    {
+        _index = 0;
+        for (; !linq_at_end(_iter, _end); ++_iter)
+        {
+            const auto& key = _key.emplace(_keySelector(*_iter));
+            _group = _table->find(key);
+            if (_group || Outer)
+            {
+                return;
+            }
+        }
+        _group = nullptr;
+        _key.reset();
+    }
+
+    const build_type& build_value() const
+    {
+        return _group ? (*_group)[_index] : _table->default_value();
+    }
+
+    template <class TProbe>
+    static auto make_row(const key_type& key, TProbe&& probe, const build_type& build, std::false_type)
+    {
+        return std::tuple<key_type, deref_iter_t<TIterator>, build_type>{key, std::forward<TProbe>(probe), build};
+    }
+
+    template <class TProbe>
+    static auto make_row(const key_type& key, TProbe&& probe, const build_type& build, std::true_type)
+    {
+        return std::tuple<key_type, build_type, deref_iter_t<TIterator>>{key, build, std::forward<TProbe>(probe)};
+    }
+
+public:
+    using value_type = typename traits::value_type;
+    using pointer = typename traits::pointer;
+    using reference = typename traits::reference;
+    using difference_type = typename traits::difference_type;
+    using iterator_category = typename traits::iterator_category;
+
+    using sentinel = sentinel_t<TIterator>;
+
+    join_iterator() = default;
+
+    join_iterator(const TIterator& begin, const sentinel& end, const TFunction& keySelector, const std::shared_ptr<const TTable>& table)
+        : _iter(begin)
+        , _end(end)
+        , _keySelector(keySelector)
+        , _table(table)
+        , _group(nullptr)
+        , _index(0)
+    {
+        check_move_iterator();
+    }
+
+    const TIterator& source() const
+    {
+        return _iter;
+    }
+
+    sentinel end_sentinel() const
+    {
+        return linq_sentinel(_iter);
+    }
+
+    bool at_end(const sentinel& end) const
+    {
+        return linq_at_end(_iter, end);
+    }
+
+    self& operator++()
+    {
+        if (!_group || ++_index == _group->size())
+        {
+            ++_iter;
+            check_move_iterator();
+        }
+        return *this;
+    }
+
+    value_type operator*() const
+    {
+        return make_row(_key.get(), *_iter, build_value(), std::integral_constant<bool, Swap>{});
+    }
+
+    bool operator==(const self& other) const
+    {
+        return _iter == other._iter && (linq_at_end(_iter, _end) || _index == other._index);
+    }
+
+    bool operator!=(const self& other) const
+    {
+        return !((*this) == other);
+    }
+
+    template <class TSink>
+    bool push(const self& end, TSink& sink)
+    {
+        for (; _iter != end._iter; ++_iter, check_move_iterator())
+        {
+            if (!_group)
+            {
+                if (!sink(make_row(_key.get(), *_iter, _table->default_value(), std::integral_constant<bool, Swap>{})))
+                {
+                    return false;
+                }
+                continue;
+            }
+            decltype(auto) probe = *_iter;
+            for (; _index != _group->size(); _index++)
+            {
+                if (!sink(make_row(_key.get(), probe, (*_group)[_index], std::integral_constant<bool, Swap>{})))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+template <class TContainer>
+auto from(const TContainer& cont) -> linq_collection<decltype(std::cbegin(cont))>;
+
+template <class TIterator>
+auto from(const TIterator& a, const TIterator& b) -> linq_collection<TIterator>;
+
+template <class T>
+linq<T> from_values(const std::initializer_list<T>& cont)
+{
+    using cont_type = arena_vector<T>;
+    auto xs = make_arena_shared<cont_type>(cont);
+    return linq_collection<boxed_container_iterator<cont_type>>(
+        boxed_container_iterator<cont_type>(xs, xs->begin()),
+        boxed_container_iterator<cont_type>(xs, xs->end())
+    );
+}
+
+template <class TContainer/*, std::enable_if_t<!std::is_same<
+              std::decay_t<TContainer>,
+              std::initializer_list<deref_iter_t<decltype(std::begin(std::declval<TContainer>()))>>>::value>* = nullptr*/>
+auto from_values(const TContainer& cont) -> linq<deref_iter_t<decltype(std::begin(std::declval<TContainer>()))>>
+{
+    auto xs = make_arena_shared<TContainer>(cont);
+    using iter_type = boxed_container_iterator<TContainer>;
+    return linq_collection<iter_type>(
+        iter_type(xs, std::begin(*xs)),
+        iter_type(xs, std::end(*xs))
+    );
+}
+
+template <class TContainer/*, std::enable_if_t<!std::is_same<
+              std::decay_t<TContainer>,
+              std::initializer_list<deref_iter_t<decltype(std::begin(std::declval<TContainer>()))>>>::value>* = nullptr*/>
+auto from_values(TContainer&& cont)
+-> linq<deref_iter_t<decltype(std::begin(std::declval<TContainer>()))>>
+{
+    auto xs = make_arena_shared<TContainer>(std::move(cont));
+    using iter_type = boxed_container_iterator<TContainer>;
+    return linq_collection<iter_type>(
+        iter_type(xs, std::begin(*xs)),
+        iter_type(xs, std::end(*xs))
+    );
+}
+
+//shares an existing container instead of copying it, the container must not change afterwards
+template <class TContainer>
+linq_collection<boxed_container_iterator<TContainer>> from_shared(const std::shared_ptr<TContainer>& xs)
+{
+    using iter_type = boxed_container_iterator<TContainer>;
+    return {
+        iter_type(xs, std::begin(*xs)),
+        iter_type(xs, std::end(*xs))
+    };
+}
+
+template <class T>
+linq<T> from_value(const T& value)
+{
+    return from_values({value});
+}
+
+template <class T>
+linq<T> from_empty()
+{
+    using iter_type = empty_iterator<T>;
+    return linq_collection<iter_type>{
+        iter_type{},
+        iter_type{}
+    };
+}
+
+/*
+ * explain() renders the iterator type of a query as an operator tree, outermost operator first,
+ * annotated with the counters of instrumented stages
+ */
+inline const char* category_name(std::input_iterator_tag)
+{
+    return "input";
+}
+
+inline const char* category_name(std::forward_iterator_tag)
+{
+    return "forward";
+}
+
+inline const char* category_name(std::bidirectional_iterator_tag)
+{
+    return "bidirectional";
+}
+
+inline const char* category_name(std::random_access_iterator_tag)
+{
+    return "random access";
+}
+
+template <class TFunction>
+void explain_function(std::ostream&, const TFunction&)
+{
+}
+
+#ifdef PL_LINQ_INSTRUMENT
+template <class TFunction, bool IsPredicate>
+void explain_function(std::ostream& out, const instrumented_function<TFunction, IsPredicate>& func)
+{
+    const auto& c = func.counters();
+    out << " [calls=" << c.calls << " passed=" << c.passed << " allocations=" << c.allocations << " time=" << c.nanoseconds << "ns]";
+}
+#endif
+
+//fused stages list the counters of every function they were fused from
+template <class TFunction1, class TFunction2>
+void explain_function(std::ostream& out, const fused_predicate<TFunction1, TFunction2>& func)
+{
+    explain_function(out, func.first);
+    explain_function(out, func.second);
+}
+
+template <class TFunction1, class TFunction2>
+void explain_function(std::ostream& out, const fused_selector<TFunction1, TFunction2>& func)
+{
+    explain_function(out, func.first);
+    explain_function(out, func.second);
+}
+
+inline std::ostream& explain_line(std::ostream& out, std::size_t depth, const char* name)
+{
+    return out << std::string(depth * 2, ' ') << name;
+}
+
+template <class TIterator>
+void explain_stage(std::ostream& out, const TIterator&, std::size_t depth)
+{
+    explain_line(out, depth, "source") << " (" << category_name(typename std::iterator_traits<TIterator>::iterator_category{}) << ")\n";
+}
+
+template <class TIterator, class TFunction>
+void explain_stage(std::ostream& out, const select_iterator<TIterator, TFunction>& iter, std::size_t depth)
+{
+    explain_line(out, depth, "select");
+    explain_function(out, iter.selector());
+    out << "\n";
+    explain_stage(out, iter.source(), depth + 1);
+}
+
+template <class TIterator, class TFunction>
+void explain_stage(std::ostream& out, const where_iterator<TIterator, TFunction>& iter, std::size_t depth)
+{
+    explain_line(out, depth, "where");
+    explain_function(out, iter.predicate());
+    out << "\n";
+    explain_stage(out, iter.source(), depth + 1);
+}
+
+template <class TIterator, class TFunction>
+void explain_stage(std::ostream& out, const skip_while_iterator<TIterator, TFunction>& iter, std::size_t depth)
+{
+    explain_line(out, depth, "skip_while");
+    explain_function(out, iter.predicate());
+    out << "\n";
+    explain_stage(out, iter.source(), depth + 1);
+}
+
+template <class TIterator, class TFunction>
+void explain_stage(std::ostream& out, const take_while_iterator<TIterator, TFunction>& iter, std::size_t depth)
+{
+    explain_line(out, depth, "take_while");
+    explain_function(out, iter.predicate());
+    out << "\n";
+    explain_stage(out, iter.source(), depth + 1);
+}
+
+template <class TIterator, class TFunction>
+void explain_stage(std::ostream& out, const select_many_iterator<TIterator, TFunction>& iter, std::size_t depth)
+{
+    explain_line(out, depth, "select_many");
+    explain_function(out, iter.selector());
+    out << "\n";
+    explain_stage(out, iter.source(), depth + 1);
+}
+
+template <class TIterator>
+void explain_stage(std::ostream& out, const skip_iterator<TIterator>& iter, std::size_t depth)
+{
+    explain_line(out, depth, "skip") << "\n";
+    explain_stage(out, iter.source(), depth + 1);
+}
+
+template <class TIterator>
+void explain_stage(std::ostream& out, const take_iterator<TIterator>& iter, std::size_t depth)
+{
+    explain_line(out, depth, "take") << "\n";
+    explain_stage(out, iter.source(), depth + 1);
+}
+
+template <class TIterator, class TFunction, class TTable>
+void explain_stage(std::ostream& out, const distinct_iterator<TIterator, TFunction, TTable>& iter, std::size_t depth)
+{
+    explain_line(out, depth, "distinct") << "\n";
+    explain_stage(out, iter.source(), depth + 1);
+}
+
+//only the probe side is part of the type, the build side has already been hashed
+template <class TIterator, class TFunction, class TTable, bool Outer, bool Swap>
+void explain_stage(std::ostream& out, const join_iterator<TIterator, TFunction, TTable, Outer, Swap>& iter, std::size_t depth)
+{
+    explain_line(out, depth, !Outer ? "join" : Swap ? "right_join" : "left_join") << "\n";
+    explain_stage(out, iter.source(), depth + 1);
+}
+
+template <class TIterator1, class TIterator2>
+void explain_stage(std::ostream& out, const concat_iterator<TIterator1, TIterator2>& iter, std::size_t depth)
+{
+    explain_line(out, depth, "concat") << "\n";
+    explain_stage(out, iter.first_source(), depth + 1);
+    explain_stage(out, iter.second_source(), depth + 1);
+}
+
+template <class TIterator1, class TIterator2>
+void explain_stage(std::ostream& out, const zip_iterator<TIterator1, TIterator2>& iter, std::size_t depth)
+{
+    explain_line(out, depth, "zip_with") << "\n";
+    explain_stage(out, iter.first_source(), depth + 1);
+    explain_stage(out, iter.second_source(), depth + 1);
+}
+
+template <class TState>
+void explain_stage(std::ostream& out, const order_by_iterator<TState>&, std::size_t depth)
+{
+    explain_line(out, depth, "order_by") << "\n";
+}
+
+template <class T>
+void explain_stage(std::ostream& out, const any_iterator<T>&, std::size_t depth)
+{
+    explain_line(out, depth, "linq (type erased)") << "\n";
+}
+
+template <class T>
+void explain_stage(std::ostream& out, const empty_iterator<T>&, std::size_t depth)
+{
+    explain_line(out, depth, "empty") << "\n";
+}
+
+template <class TIterator>
+class linq_collection
+{
+public:
+    using value_type = deref_iter_t<TIterator>;
+    using reference = deref_ref_t<TIterator>;
+private:
+    using self = linq_collection<TIterator>;
+
+    TIterator _begin;
+    TIterator _end;
+
+public:
+    linq_collection(TIterator begin, TIterator end)
+        : _begin(std::move(begin))
+        , _end(std::move(end))
+    {
+    }
+
+    TIterator begin() const
+    {
+        return _begin;
+    }
+
+    TIterator end() const
+    {
+        return _end;
+    }
+
+    /*
+     * functions are forwarded into the stage, so a temporary lambda is moved instead of copied,
+     * and calling an operator on a temporary query moves its iterators into the next stage
+     */
+    template <class TFunction>
+    auto select(TFunction&& func) const&
+    {
+        return select_impl(_begin, _end, instrument_stage<false>(std::forward<TFunction>(func)));
+    }
+
+    template <class TFunction>
+    auto select(TFunction&& func) &&
+    {
+        return select_impl(std::move(_begin), std::move(_end), instrument_stage<false>(std::forward<TFunction>(func)));
+    }
+
+    template <class TFunction>
+    auto where(TFunction&& func) const&
+    {
+        return where_impl(_begin, _end, instrument_stage<true>(std::forward<TFunction>(func)));
+    }
+
+    template <class TFunction>
+    auto where(TFunction&& func) &&
+    {
+        return where_impl(std::move(_begin), std::move(_end), instrument_stage<true>(std::forward<TFunction>(func)));
+    }
+
+    auto skip(std::size_t count) const
+    {
+        return skip_impl(count, is_random_access<TIterator>{});
+    }
+
+    template <class TFunction>
+    auto skip_while(TFunction&& func) const&
+    {
+        return stage_impl<skip_while_iterator>(_begin, _end, instrument_stage<true>(std::forward<TFunction>(func)));
+    }
+
+    template <class TFunction>
+    auto skip_while(TFunction&& func) &&
+    {
+        return stage_impl<skip_while_iterator>(std::move(_begin), std::move(_end), instrument_stage<true>(std::forward<TFunction>(func)));
+    }
+
+    auto take(std::size_t count) const
+    {
+        return take_impl(count, is_random_access<TIterator>{});
+    }
+
+    template <typename TFunction>
+    auto take_while(TFunction&& func) const&
+    {
+        return stage_impl<take_while_iterator>(_begin, _end, instrument_stage<true>(std::forward<TFunction>(func)));
+    }
+
+    template <class TFunction>
+    auto take_while(TFunction&& func) &&
+    {
+        return stage_impl<take_while_iterator>(std::move(_begin), std::move(_end), instrument_stage<true>(std::forward<TFunction>(func)));
+    }
+
+    template <class TIterator2>
+    linq_collection<concat_iterator<TIterator, TIterator2>> concat_impl(const linq_collection<TIterator2>& other) const
+    {
+        return {
+            concat_iterator<TIterator, TIterator2>{_begin, _end, other.begin(), other.begin()},
+            concat_iterator<TIterator, TIterator2>{_end, _end, other.begin(), other.end()}
+        };
+    }
+
+    template <class TIterator2>
+    auto concat(const linq_collection<TIterator2>& cont)
+    -> decltype(concat_impl(cont))
+    {
+        return concat_impl(cont);
+    }
+
+    template <class TContainer>
+    auto concat(const TContainer& other) const
+    -> decltype(concat_impl(from(other)))
+    {
+        return concat_impl(from(other));
+    }
+
+    template <class T>
+    auto concat(const std::initializer_list<T>& ilist) const
+    -> decltype(concat_impl(from(ilist)))
+    {
+        return concat_impl(from(ilist));
+    }
+
+    template <class T>
+    auto contains(const T& t) const -> decltype(std::declval<value_type>() == std::declval<T>() , bool())
+    {
+        auto it = _begin;
+        return !linq_push(it, _end, [&t](const auto& x)
+                          {
+                              return !(x == t);
+                          });
+    }
+
+    std::size_t count() const
+    {
+        return count_impl(_begin, _end);
+    }
+
+    linq<value_type> default_if_empty(const value_type& v) const
+    {
+        if (empty())
+        {
+            return from_value(v);
+        }
+        return *this;
+    }
+
+    value_type element_at(std::size_t i) const
+    {
+        auto iter = _begin;
+        if (advance_bounded(iter, _end, i) == i && iter != _end)
+        {
+            return *iter;
+        }
+        throw index_out_of_range("index out of range: " + std::to_string(i));
+    }
+
+    bool empty() const
+    {
+        return _begin == _end;
+    }
+
+    std::string explain() const
+    {
+        std::ostringstream out;
+        explain_stage(out, _begin, 0);
+        return out.str();
+    }
+
+    value_type first() const
+    {
+        if (empty())
+        {
+            empty_err();
+        }
+        return *_begin;
+    }
+
+    value_type first_or_default(const value_type& v) const
+    {
+        return empty() ? v : *_begin;
+    }
+
+    value_type last() const
+    {
+        if (empty())
+        {
+            empty_err();
+        }
+        return *last_iterator(is_bidirectional<TIterator>{});
+    }
+
+    value_type last_or_default(const value_type& v) const
+    {
+        return empty() ? v : *last_iterator(is_bidirectional<TIterator>{});
+    }
+
+    linq_collection<TIterator> single() const
+    {
+        auto it = _begin;
+        if (it == _end)
+        {
+            empty_err();
+        }
+        ++it;
+        if (it != _end)
+        {
+            throw element_not_unique("more than one element in collection");
+        }
+        return *this;
+    }
+
+    linq<value_type> single_or_default(const value_type& v) const
+    {
+        auto it = _begin;
+        if (it == _end)
+        {
+            return from_value(v);
+        }
+        ++it;
+        if (it != _end)
+        {
+            throw element_not_unique("more than one element in collection");
+        }
+        return *this;
+    }
+
+    template <class TIterator2>
+    bool sequence_equal_impl(const linq_collection<TIterator2>& e) const
+    {
+        auto it1 = _begin;
+        auto it1e = _end;
+        auto it2 = e.begin();
+        auto it2e = e.end();
+
+        while (it1 != it1e && it2 != it2e)
+        {
+            if (*it1 != *it2)
+            {
+                return false;
+            }
+            ++it1;
+            ++it2;
+        }
+        return it1 == it1e && it2 == it2e;
+    }
+
+    template <class TIterator2>
+    auto sequence_equal(const linq_collection<TIterator2>& cont) const
+    -> decltype(sequence_equal_impl(cont))
+    {
+        return sequence_equal_impl(cont);
+    }
+
+    template <class TContainer>
+    auto sequence_equal(const TContainer& other) const
+    -> decltype(sequence_equal_impl(from(other)))
+    {
+        return sequence_equal_impl(from(other));
+    }
+
+    template <class T>
+    auto sequence_equal(const std::initializer_list<T>& ilist) const
+    -> decltype(sequence_equal_impl(from(ilist)))
+    {
+        return sequence_equal_impl(from(ilist));
+    }
+
+    template <class TFunction, class THash = std::hash<std::decay_t<decltype(std::declval<TFunction>()(std::declval<value_type>()))>>,
+              class TEqual = std::equal_to<std::decay_t<decltype(std::declval<TFunction>()(std::declval<value_type>()))>>>
+    auto distinct_by(const TFunction& keySelector, const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    {
+        using key_type = std::decay_t<decltype(keySelector(std::declval<value_type>()))>;
+        using table_type = first_seen_table<key_type, THash, TEqual>;
+        using iter_type = distinct_iterator<TIterator, TFunction, table_type>;
+
+        //every enumeration records the keys it saw in its own table
+        std::shared_ptr<const table_type> prototype = make_arena_shared<table_type>(hash, eq);
+        auto end = linq_sentinel(_end);
+        return linq_collection<iter_type>{
+            iter_type{_begin, end, keySelector, prototype},
+            iter_type{_end, end, keySelector, prototype}
+        };
+    }
+
+    template <class THash = std::hash<value_type>, class TEqual = std::equal_to<value_type>>
+    auto distinct(const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    {
+        return distinct_by(identity_selector(), hash, eq);
+    }
+
+    template <class TIterator2, class THash, class TEqual>
+    auto except_with_impl(const linq_collection<TIterator2>& e, const THash& hash, const TEqual& eq) const
+    {
+        using set_type = std::unordered_set<value_type, THash, TEqual, arena_allocator<value_type>>;
+        std::shared_ptr<const set_type> excluded = make_arena_shared<set_type>(e.begin(), e.end(), 0, hash, eq);
+        return where([excluded](const value_type& value)
+            {
+                return excluded->count(value) == 0;
+            }).distinct(hash, eq);
+    }
+
+    template <class TContainer, class THash = std::hash<value_type>, class TEqual = std::equal_to<value_type>>
+    auto except_with(const TContainer& other, const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    -> decltype(except_with_impl(from(other), hash, eq))
+    {
+        return except_with_impl(from(other), hash, eq);
+    }
+
+    template <class T, class THash = std::hash<value_type>, class TEqual = std::equal_to<value_type>>
+    auto except_with(const std::initializer_list<T>& ilist, const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    -> decltype(except_with_impl(from(ilist), hash, eq))
+    {
+        return except_with_impl(from(ilist), hash, eq);
+    }
+
+    template <class TIterator2, class THash = std::hash<value_type>, class TEqual = std::equal_to<value_type>>
+    auto except_with(const linq_collection<TIterator2>& e, const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    -> decltype(except_with_impl(e, hash, eq))
+    {
+        return except_with_impl(e, hash, eq);
+    }
+
+    template <class TIterator2, class THash, class TEqual,
+              std::enable_if_t<std::is_same<value_type, std::decay_t<deref_iter_t<TIterator2>>>::value>* = nullptr>
+    auto intersect_with_impl(const linq_collection<TIterator2>& e, const THash& hash, const TEqual& eq) const
+    {
+        using set_type = std::unordered_set<value_type, THash, TEqual, arena_allocator<value_type>>;
+        std::shared_ptr<const set_type> included = make_arena_shared<set_type>(e.begin(), e.end(), 0, hash, eq);
+        return where([included](const value_type& value)
+            {
+                return included->count(value) != 0;
+            }).distinct(hash, eq);
+    }
+
+    template <class TIterator2, class THash = std::hash<value_type>, class TEqual = std::equal_to<value_type>>
+    auto intersect_with(const linq_collection<TIterator2>& e, const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    -> decltype(intersect_with_impl(e, hash, eq))
+    {
+        return intersect_with_impl(e, hash, eq);
+    }
+
+    template <class TContainer, class THash = std::hash<value_type>, class TEqual = std::equal_to<value_type>>
+    auto intersect_with(const TContainer& other, const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    -> decltype(intersect_with_impl(from(other), hash, eq))
+    {
+        return intersect_with_impl(from(other), hash, eq);
+    }
+
+    template <class T, class THash = std::hash<value_type>, class TEqual = std::equal_to<value_type>>
+    auto intersect_with(const std::initializer_list<T>& ilist, const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    -> decltype(intersect_with_impl(from(ilist), hash, eq))
+    {
+        return intersect_with_impl(from(ilist), hash, eq);
+    }
+
+    template <class TIterator2, class THash, class TEqual,
+              std::enable_if_t<std::is_same<value_type, std::decay_t<deref_iter_t<TIterator2>>>::value>* = nullptr>
+    auto union_with_impl(const linq_collection<TIterator2>& e, const THash& hash, const TEqual& eq) const
+    {
+        return concat(e).distinct(hash, eq);
+    }
+
+    template <class TIterator2, class THash = std::hash<value_type>, class TEqual = std::equal_to<value_type>>
+    auto union_with(const linq_collection<TIterator2>& e, const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    -> decltype(union_with_impl(e, hash, eq))
+    {
+        return union_with_impl(e, hash, eq);
+    }
+
+    template <class TContainer, class THash = std::hash<value_type>, class TEqual = std::equal_to<value_type>>
+    auto union_with(const TContainer& other, const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    -> decltype(union_with_impl(from_values(std::vector<std::decay_t<decltype(*std::begin(other))>>()), hash, eq))
+    {
+        //the result is lazy, keep a copy since other may be a temporary
+        using elem_type = std::decay_t<decltype(*std::begin(other))>;
+        return union_with_impl(from_values(std::vector<elem_type>(std::begin(other), std::end(other))), hash, eq);
+    }
+
+    template <class T, class THash = std::hash<value_type>, class TEqual = std::equal_to<value_type>>
+    auto union_with(const std::initializer_list<T>& ilist, const THash& hash = THash(), const TEqual& eq = TEqual()) const
+    -> decltype(union_with_impl(from_values(std::vector<T>(ilist)), hash, eq))
+    {
+        //the result is lazy, keep a copy since ilist dies at the end of the full expression
+        return union_with_impl(from_values(std::vector<T>(ilist)), hash, eq);
+    }
+
+    template <class TFunction>
+    value_type aggregate(const TFunction& f) const
+    {
+        if (empty())
+        {
+            empty_err();
+        }
+        auto it = _begin;
+        value_type res = *it;
+        ++it;
+        linq_push(it, _end, [&res, &f](const auto& x)
+                  {
+                      res = f(res, x);
+                      return true;
+                  });
+        return res;
+    }
+
+    template <class TResult, class TFunction>
+    TResult aggregate(const TResult& init, const TFunction& f) const
+    {
+        TResult res = init;
+        auto it = _begin;
+        linq_push(it, _end, [&res, &f](const auto& x)
+                  {
+                      res = f(res, x);
+                      return true;
+                  });
+        return res;
+    }
+
+    template <class TFunction>
+    bool all(const TFunction& f) const
+    {
+        auto it = _begin;
+        return linq_push(it, _end, [&f](const auto& x)
+                         {
+                             return static_cast<bool>(f(x));
+                         });
+    }
+
+    bool any() const
+    {
+        return !empty();
+    }
+
+    template <class TFunction>
+    bool any(const TFunction& f) const
+    {
+        return !where(f).empty();
+    }
+
+    template <class TResult>
+    TResult average() const
+    {
+        return average_impl<TResult>(std::integral_constant<bool, is_simd_source<TIterator>::value && std::is_same<TResult, value_type>::value>{});
+    }
+
+    value_type max() const
+    {
+        return reduce_impl<simd_max>(is_simd_source<TIterator>{});
+    }
+
+    value_type min() const
+    {
+        return reduce_impl<simd_min>(is_simd_source<TIterator>{});
+    }
+
+    value_type sum() const
+    {
+        return reduce_impl<simd_sum>(is_simd_source<TIterator>{});
+    }
+
+
+    value_type product() const
+    {
+        return aggregate([](const auto& x, const auto& y)
+            {
+                return x * y;
+            });
+    }
+
+
+    template <typename TFunction>
+    auto select_many(TFunction&& f) const&
+    {
+        return stage_impl<select_many_iterator>(_begin, _end, instrument_stage<false>(std::forward<TFunction>(f)));
+    }
+
+    template <typename TFunction>
+    auto select_many(TFunction&& f) &&
+    {
+        return stage_impl<select_many_iterator>(std::move(_begin), std::move(_end), instrument_stage<false>(std::forward<TFunction>(f)));
+    }
+
+    template <class TFunction>
+    auto group_by(const TFunction& keySelector) const
+    -> linq<std::pair<std::decay_t<decltype(keySelector(std::declval<value_type>()))>, linq<value_type>>>
+    {
+        using key_type = std::decay_t<decltype(keySelector(std::declval<value_type>()))>;
+        using value_vector = arena_vector<value_type>;
+
+        hash_groups<key_type, value_vector> index;
+        auto iter = _begin;
+        linq_push(iter, _end, [&index, &keySelector](const auto& value)
+                  {
+                      index.find_or_add(keySelector(value), []() { return value_vector(); }).push_back(value);
+                      return true;
+                  });
+
+        //every group aliases the shared vector instead of being copied out of it
+        using group_vector = arena_vector<std::pair<key_type, value_vector>>;
+        std::shared_ptr<const group_vector> groups = make_arena_shared<group_vector>(index.release());
+        arena_vector<std::pair<key_type, linq<value_type>>> res;
+        res.reserve(groups->size());
+        for (const auto& p : *groups)
+        {
+            res.emplace_back(p.first, from_shared(std::shared_ptr<const value_vector>(groups, &p.second)));
+        }
+        return from_values(std::move(res));
+    }
+
+    //folds every group into one accumulator per key without storing the elements
+    template <class TFunction, class TAccumulate, class TFold>
+    auto aggregate_by(const TFunction& keySelector, const TAccumulate& seed, const TFold& fold) const
+    -> linq<std::pair<std::decay_t<decltype(keySelector(std::declval<value_type>()))>, TAccumulate>>
+    {
+        using key_type = std::decay_t<decltype(keySelector(std::declval<value_type>()))>;
+
+        hash_groups<key_type, TAccumulate> index;
+        auto iter = _begin;
+        linq_push(iter, _end, [&index, &keySelector, &seed, &fold](const auto& value)
+                  {
+                      auto& acc = index.find_or_add(keySelector(value), [&seed]() { return seed; });
+                      acc = fold(std::move(acc), value);
+                      return true;
+                  });
+        return from_values(index.release());
+    }
+
+    template <class TFunction>
+    auto count_by(const TFunction& keySelector) const
+    -> linq<std::pair<std::decay_t<decltype(keySelector(std::declval<value_type>()))>, std::size_t>>
+    {
+        return aggregate_by(keySelector, std::size_t(0), [](std::size_t count, const value_type&)
+            {
+                return count + 1;
+            });
+    }
+
+    template <class TFunction, class TSelector>
+    auto sum_by(const TFunction& keySelector, const TSelector& selector) const
+    -> linq<std::pair<std::decay_t<decltype(keySelector(std::declval<value_type>()))>,
+                      std::decay_t<decltype(selector(std::declval<value_type>()))>>>
+    {
+        using sum_type = std::decay_t<decltype(selector(std::declval<value_type>()))>;
+        return aggregate_by(keySelector, sum_type(), [&selector](sum_type&& sum, const value_type& value)
+            {
+                return std::move(sum) + selector(value);
+            });
+    }
+
+    template <class TFunction>
+    auto sum_by(const TFunction& keySelector) const
+    -> linq<std::pair<std::decay_t<decltype(keySelector(std::declval<value_type>()))>, value_type>>
+    {
+        return sum_by(keySelector, identity_selector());
+    }
+
+    template <class TIterator2, class TFunction1, class TFunction2>
+    auto full_join_impl(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
+    -> linq<std::tuple<std::decay_t<decltype(keySelector1(std::declval<value_type>()))>,
+                       linq<std::decay_t<deref_iter_t<TIterator>>>,
+                       linq<std::decay_t<deref_iter_t<TIterator2>>>>>
+    {
+        using key_type = std::decay_t<decltype(keySelector1(std::declval<value_type>()))>;
+        using value_type1 = std::decay_t<deref_iter_t<TIterator>>;
+        using value_type2 = std::decay_t<deref_iter_t<TIterator2>>;
+        using group_type = std::pair<arena_vector<value_type1>, arena_vector<value_type2>>;
+        using full_join_pair_t = std::tuple<key_type, linq<value_type1>, linq<value_type2>>;
+
+        //groups are kept in order of first appearance, outer keys first
+        hash_groups<key_type, group_type> index;
+        auto new_group = []() { return group_type(); };
+
+        auto it1 = _begin;
+        linq_push(it1, _end, [&index, &new_group, &keySelector1](const auto& value)
+                  {
+                      index.find_or_add(keySelector1(value), new_group).first.push_back(value);
+                      return true;
+                  });
+        auto it2 = e.begin();
+        linq_push(it2, e.end(), [&index, &new_group, &keySelector2](const auto& value)
+                  {
+                      index.find_or_add(keySelector2(value), new_group).second.push_back(value);
+                      return true;
+                  });
+
+        using group_vector = arena_vector<std::pair<key_type, group_type>>;
+        std::shared_ptr<const group_vector> groups = make_arena_shared<group_vector>(index.release());
+        arena_vector<full_join_pair_t> result;
+        result.reserve(groups->size());
+        for (auto& group : *groups)
+        {
+            result.emplace_back(group.first,
+                                from_shared(std::shared_ptr<const arena_vector<value_type1>>(groups, &group.second.first)),
+                                from_shared(std::shared_ptr<const arena_vector<value_type2>>(groups, &group.second.second)));
+        }
+        return from_values(std::move(result));
+    }
+
+    template <class TIterator2, class TFunction1, class TFunction2>
+    auto full_join(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
+    -> decltype(full_join_impl(e, keySelector1, keySelector2))
+    {
+        return full_join_impl(e, keySelector1, keySelector2);
+    }
+
+    template <class TContainer, class TFunction1, class TFunction2>
+    auto full_join(const TContainer& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
+    -> decltype(full_join_impl(from(e), keySelector1, keySelector2))
+    {
+        return full_join_impl(from(e), keySelector1, keySelector2);
+    }
+
+    template <class T, class TFunction1, class TFunction2>
+    auto full_join(const std::initializer_list<T>& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
+    -> decltype(full_join_impl(from(e), keySelector1, keySelector2))
+    {
+        return full_join_impl(from(e), keySelector1, keySelector2);
+    }
+
+    template <class TIterator2, class TFunction1, class TFunction2>
+    auto group_join_impl(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
+    {
+        using key_type = std::decay_t<decltype(keySelector1(std::declval<value_type>()))>;
+        using value_type2 = std::decay_t<deref_iter_t<TIterator2>>;
+        using table_type = hash_join_table<key_type, value_type2>;
+        using group_join_pair_t = std::tuple<key_type, value_type, linq<value_type2>>;
+
+        std::shared_ptr<const table_type> table = make_arena_shared<table_type>(e.begin(), e.end(), keySelector2);
+        return select([table, keySelector1](const value_type& outer) -> group_join_pair_t
+            {
+                auto key = keySelector1(outer);
+                auto group = table->find(key);
+                if (!group)
+                {
+                    return group_join_pair_t{std::move(key), outer, from_empty<value_type2>()};
+                }
+                return group_join_pair_t{std::move(key), outer, from_shared(std::shared_ptr<const typename table_type::group_type>(table, group))};
+            });
+    }
+
+    template <class TIterator2, class TFunction1, class TFunction2>
+    auto group_join(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
+    -> decltype(group_join_impl(e, keySelector1, keySelector2))
+    {
+        return group_join_impl(e, keySelector1, keySelector2);
+    }
+
+    template <class TContainer, class TFunction1, class TFunction2>
+    auto group_join(const TContainer& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
+    -> decltype(group_join_impl(from(e), keySelector1, keySelector2))
+    {
+        return group_join_impl(from(e), keySelector1, keySelector2);
+    }
+
+    template <class T, class TFunction1, class TFunction2>
+    auto group_join(const std::initializer_list<T>& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
+    -> decltype(group_join_impl(from(e), keySelector1, keySelector2))
+    {
+        return group_join_impl(from(e), keySelector1, keySelector2);
+    }
+
+    template <class TIterator2, class TFunction1, class TFunction2>
+    auto join_impl(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
+    {
+        using key_type = std::decay_t<decltype(keySelector1(std::declval<value_type>()))>;
+        using table_type = hash_join_table<key_type, std::decay_t<deref_iter_t<TIterator2>>>;
+        using iter_type = join_iterator<TIterator, TFunction1, table_type, false, false>;
+
+        std::shared_ptr<const table_type> table = make_arena_shared<table_type>(e.begin(), e.end(), keySelector2);
+        auto end = linq_sentinel(_end);
+        return linq_collection<iter_type>{
+            iter_type{_begin, end, keySelector1, table},
+            iter_type{_end, end, keySelector1, table}
+        };
+    }
+
+    template <class TIterator2, class TFunction1, class TFunction2>
+    auto left_join_impl(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2,
+                        const std::decay_t<deref_iter_t<TIterator2>>& default_value) const
+    {
+        using key_type = std::decay_t<decltype(keySelector1(std::declval<value_type>()))>;
+        using table_type = hash_join_table<key_type, std::decay_t<deref_iter_t<TIterator2>>>;
+        using iter_type = join_iterator<TIterator, TFunction1, table_type, true, false>;
+
+        auto table = make_arena_shared<table_type>(e.begin(), e.end(), keySelector2);
+        table->set_default_value(default_value);
+        auto end = linq_sentinel(_end);
+        return linq_collection<iter_type>{
+            iter_type{_begin, end, keySelector1, table},
+            iter_type{_end, end, keySelector1, table}
+        };
+    }
+
+    template <class TIterator2, class TFunction1, class TFunction2>
+    auto right_join_impl(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2,
+                         const value_type& default_value) const
+    {
+        using key_type = std::decay_t<decltype(keySelector2(std::declval<deref_iter_t<TIterator2>>()))>;
+        using table_type = hash_join_table<key_type, value_type>;
+        using iter_type = join_iterator<TIterator2, TFunction2, table_type, true, true>;
+
+        auto table = make_arena_shared<table_type>(_begin, _end, keySelector1);
+        table->set_default_value(default_value);
+        auto end = linq_sentinel(e.end());
+        return linq_collection<iter_type>{
+            iter_type{e.begin(), end, keySelector2, table},
+            iter_type{e.end(), end, keySelector2, table}
+        };
+    }
+
+    template <class TIterator2, class TFunction1, class TFunction2>
+    auto left_join(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2,
+                   const std::decay_t<deref_iter_t<TIterator2>>& default_value = std::decay_t<deref_iter_t<TIterator2>>{}) const
+    -> decltype(left_join_impl(e, keySelector1, keySelector2, default_value))
+    {
+        return left_join_impl(e, keySelector1, keySelector2, default_value);
+    }
+
+    template <class TContainer, class TFunction1, class TFunction2>
+    auto left_join(const TContainer& e, const TFunction1 keySelector1, const TFunction2 keySelector2,
+                   const deref_iter_t<decltype(std::begin(e))>& default_value = deref_iter_t<decltype(std::begin(e))>{}) const
+    -> decltype(left_join_impl(from(e), keySelector1, keySelector2, default_value))
+    {
+        return left_join_impl(from(e), keySelector1, keySelector2, default_value);
+    }
+
+    template <class T, class TFunction1, class TFunction2>
+    auto left_join(const std::initializer_list<T>& e, const TFunction1 keySelector1, const TFunction2 keySelector2,
+                   const T& default_value = T{}) const
+    -> decltype(left_join_impl(from(e), keySelector1, keySelector2, default_value))
+    {
+        return left_join_impl(from(e), keySelector1, keySelector2, default_value);
+    }
+
+    template <class TIterator2, class TFunction1, class TFunction2>
+    auto right_join(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2,
+                    const value_type& default_value = value_type{}) const
+    -> decltype(right_join_impl(e, keySelector1, keySelector2, default_value))
+    {
+        return right_join_impl(e, keySelector1, keySelector2, default_value);
+    }
+
+    template <class TContainer, class TFunction1, class TFunction2>
+    auto right_join(const TContainer& e, const TFunction1 keySelector1, const TFunction2 keySelector2,
+                    const value_type& default_value = value_type{}) const
+    -> decltype(right_join_impl(from(e), keySelector1, keySelector2, default_value))
+    {
+        return right_join_impl(from(e), keySelector1, keySelector2, default_value);
+    }
+
+    template <class T, class TFunction1, class TFunction2>
+    auto right_join(const std::initializer_list<T>& e, const TFunction1 keySelector1, const TFunction2 keySelector2,
+                    const value_type& default_value = value_type{}) const
+    -> decltype(right_join_impl(from(e), keySelector1, keySelector2, default_value))
+    {
+        return right_join_impl(from(e), keySelector1, keySelector2, default_value);
+    }
+
+    template <class TIterator2, class TFunction1, class TFunction2>
+    auto join(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
+    -> decltype(join_impl(e, keySelector1, keySelector2))
+    {
+        return join_impl(e, keySelector1, keySelector2);
+    }
+
+    template <class TContainer, class TFunction1, class TFunction2>
+    auto join(const TContainer& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
+    -> decltype(join_impl(from(e), keySelector1, keySelector2))
+    {
+        return join_impl(from(e), keySelector1, keySelector2);
+    }
+
+    template <class T, class TFunction1, class TFunction2>
+    auto join(const std::initializer_list<T>& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
+    -> decltype(join_impl(from(e), keySelector1, keySelector2))
+    {
+        return join_impl(from(e), keySelector1, keySelector2);
+    }
+
+    template <class TFunction>
+    auto first_order_by(const TFunction& keySelector) const
+    -> linq<linq<value_type>>
+    {
+        using key_type = std::decay_t<decltype(keySelector(std::declval<value_type>()))>;
+        using group_type = std::pair<key_type, linq<value_type>>;
+
+        //group_by keeps the first appearance order, only the groups need sorting
+        auto groups = group_by(keySelector).to_vector();
+        std::stable_sort(groups.begin(), groups.end(), [](const group_type& a, const group_type& b)
+                         {
+                             return a.first < b.first;
+                         });
+        std::vector<linq<value_type>> res;
+        res.reserve(groups.size());
+        for (auto& group : groups)
+        {
+            res.push_back(std::move(group.second));
+        }
+        return from_values(std::move(res));
+    }
+
+    template <class TFunction>
+    auto then_order_by(const TFunction& keySelector) const
+    -> linq<value_type>
+    {
+        return select_many([keySelector](const value_type& values)
+            {
+                return values.first_order_by(keySelector);
+            });
+    }
+
+    template <class TFunction>
+    auto order_by(const TFunction& keySelector) const
+    -> ordered_linq_collection<TIterator, std::tuple<order_key<TFunction, false>>>
     {
+        return {_begin, _end, std::make_tuple(order_key<TFunction, false>{keySelector})};
     }
 
-    TIterator begin() const
+    template <class TFunction>
+    auto order_by_descending(const TFunction& keySelector) const
+    -> ordered_linq_collection<TIterator, std::tuple<order_key<TFunction, true>>>
     {
-        return _begin;
+        return {_begin, _end, std::make_tuple(order_key<TFunction, true>{keySelector})};
     }
 
-    TIterator end() const
+    //the count largest elements by key, largest first
+    template <class TFunction>
+    auto top_k(std::size_t count, const TFunction& keySelector) const
     {
-        return _end;
+        return order_by_descending(keySelector).take(count);
     }
 
+    //the count smallest elements by key, smallest first
     template <class TFunction>
-    linq_collection<select_iterator<TIterator, TFunction>> select(const TFunction& func) const
+    auto bottom_k(std::size_t count, const TFunction& keySelector) const
     {
-        return {
-            select_iterator<TIterator, TFunction>{_begin, func},
-            select_iterator<TIterator, TFunction>{_end, func}
-        };
+        return order_by(keySelector).take(count);
     }
 
     template <class TFunction>
-    linq_collection<where_iterator<TIterator, TFunction>> where(const TFunction& func) const
+    value_type min_by(const TFunction& keySelector) const
     {
-        return {
-            where_iterator<TIterator, TFunction>{_begin, _end, func},
-            where_iterator<TIterator, TFunction>{_end, _end, func}
-        };
+        return extreme_by(keySelector, std::false_type{});
     }
 
-    linq_collection<skip_iterator<TIterator>> skip(std::size_t count) const
+    template <class TFunction>
+    value_type max_by(const TFunction& keySelector) const
     {
-        return {
-            skip_iterator<TIterator>{_begin, _end, count},
-            skip_iterator<TIterator>{_end, _end, count},
-        };
+        return extreme_by(keySelector, std::true_type{});
     }
 
-    template <class TFunction>
-    linq_collection<skip_while_iterator<TIterator, TFunction>> skip_while(const TFunction& func) const
+    template <class TIterator2>
+    auto zip_with_impl(const linq_collection<TIterator2>& e) const
+    -> linq_collection<zip_iterator<TIterator, TIterator2>>
     {
-        return {
-            skip_while_iterator<TIterator, TFunction>{_begin, _end, func},
-            skip_while_iterator<TIterator, TFunction>{_end, _end, func}
-        };
+        return zip_with_impl(e, std::integral_constant<bool, is_random_access<TIterator>::value && is_random_access<TIterator2>::value>{});
     }
 
-    linq_collection<take_iterator<TIterator>> take(std::size_t count) const
+    template <class TIterator2>
+    auto zip_with(const linq_collection<TIterator2>& e) const
+    -> decltype(zip_with_impl(e))
     {
-        return {
-            take_iterator<TIterator>{_begin, _end, count},
-            take_iterator<TIterator>{_end, _end, count}
-        };
+        return zip_with_impl(e);
     }
 
-    template <typename TFunction>
-    linq_collection<take_while_iterator<TIterator, TFunction>> take_while(const TFunction& func) const
+    template <class TContainer>
+    auto zip_with(const TContainer& other) const
+    -> decltype(zip_with_impl(from(other)))
     {
-        return {
-            take_while_iterator<TIterator, TFunction>{_begin, _end, func},
-            take_while_iterator<TIterator, TFunction>{_end, _end, func}
-        };
+        return zip_with_impl(from(other));
     }
 
-    template <class TIterator2>
-    linq_collection<concat_iterator<TIterator, TIterator2>> concat_impl(const linq_collection<TIterator2>& other) const
+    template <class T>
+    auto zip_with(const std::initializer_list<T>& ilist) const
+    -> decltype(zip_with_impl(from(ilist)))
     {
-        return {
-            concat_iterator<TIterator, TIterator2>{_begin, _end, other.begin(), other.end()},
-            concat_iterator<TIterator, TIterator2>{_end, _end, other.end(), other.end()}
-        };
+        return zip_with_impl(from(ilist));
     }
 
-    template <class TIterator2>
-    auto concat(const linq_collection<TIterator2>& cont)
-    -> decltype(concat_impl(cont))
+    /*
+     * runs the following where/select chain and terminal operator on a thread pool.
+     * Sources without random access are buffered into a vector first.
+     */
+    auto as_parallel(thread_pool& pool) const
     {
-        return concat_impl(cont);
+        return as_parallel_impl(pool, is_random_access<TIterator>{});
     }
 
+    auto as_parallel() const;
+
     template <class TContainer>
-    auto concat(const TContainer& other) const
-    -> decltype(concat_impl(from(other)))
+    TContainer to_container() const
     {
-        return concat_impl(from(other));
+        TContainer res;
+        reserve_container(res, 0);
+        auto it = _begin;
+        linq_push(it, _end, [&res](auto&& x)
+                  {
+                      res.insert(res.end(), std::forward<decltype(x)>(x));
+                      return true;
+                  });
+        return res;
     }
 
-    template <class T>
-    auto concat(const std::initializer_list<T>& ilist) const
-    -> decltype(concat_impl(from(ilist)))
+    auto to_vector() const
     {
-        return concat_impl(from(ilist));
+        return to_container<std::vector<value_type>>();
     }
 
-    template <class T>
-    auto contains(const T& t) const -> decltype(std::declval<value_type>() == std::declval<T>() , bool())
+    auto to_deque() const
     {
-        for (const auto& x : *this)
-        {
-            if (x == t)
-            {
-                return true;
-            }
-        }
-        return false;
+        return to_container<std::deque<value_type>>();
     }
 
-    std::size_t count() const
+    auto to_list() const
     {
-        std::size_t c = 0;
-        for (auto i = _begin; i != _end; ++i)
-        {
-            c++;
-        }
-        return c;
+        return to_container<std::list<value_type>>();
     }
 
-    linq<value_type> default_if_empty(const value_type& v) const
+    template <class TContainer, class TFunction>
+    TContainer to_key_value_container(const TFunction& keySelector) const
     {
-        if (empty())
-        {
-            return from_value(v);
-        }
-        return *this;
+        auto g = select(keySelector).zip_with(*this);
+        return {g.begin(), g.end()};
     }
 
-    value_type element_at(std::size_t i) const
+    template <class TFunction>
+    auto to_map(const TFunction& keySelector)
     {
-        auto iter = _begin;
-        for (; iter != _end && i != 0; ++iter , i--)
-        {
-            //nothing
-        }
-        if (iter != _end)
-        {
-            return *iter;
-        }
-        throw std::out_of_range("index out of range: " + std::to_string(i));
+        return to_key_value_container<std::map<typename callable_traits<TFunction>::return_type, value_type>>(keySelector);
     }
 
-    bool empty() const
+    template <class TFunction>
+    auto to_multimap(const TFunction& keySelector)
     {
-        return _begin == _end;
+        return to_key_value_container<std::multimap<typename callable_traits<TFunction>::return_type, value_type>>(keySelector);
     }
 
-    value_type first() const
+    template <class TFunction>
+    auto to_unordered_map(const TFunction& keySelector)
     {
-        if (empty())
-        {
-            empty_err();
-        }
-        return *_begin;
+        return to_key_value_container<std::unordered_map<typename callable_traits<TFunction>::return_type, value_type>>(keySelector);
     }
 
-    value_type first_or_default(const value_type& v) const
+    template <class TFunction>
+    auto to_unordered_multimap(const TFunction& keySelector)
     {
-        return empty() ? v : *_begin;
+        return to_key_value_container<std::unordered_multimap<typename callable_traits<TFunction>::return_type, value_type>>(keySelector);
     }
 
-    value_type last() const
+    auto to_set()
     {
-        if (empty())
-        {
-            empty_err();
-        }
-        auto resit = _begin;
-        auto it = _begin;
-        while (it != _end)
-        {
-            resit = it;
-            ++it;
-        }
-        return *resit;
+        return to_container<std::set<value_type>>();
     }
 
-    value_type last_or_default(const value_type& v) const
+    auto to_multiset()
     {
-        auto resit = _begin;
+        return to_key_value_container<std::multiset<value_type>>();
+    }
+
+    auto to_unordered_set()
+    {
+        return to_key_value_container<std::unordered_set<value_type>>();
+    }
+
+    auto to_unordered_multiset()
+    {
+        return to_key_value_container<std::unordered_multiset<value_type>>();
+    }
+
+private:
+    [[noreturn]]
+
+    static void empty_err()
+    {
+        throw collection_empty("collection empty");
+    }
+
+    //first element with the smallest or largest key
+    template <class TFunction, class TLargest>
+    value_type extreme_by(const TFunction& keySelector, TLargest) const
+    {
+        using key_type = std::decay_t<decltype(keySelector(std::declval<value_type>()))>;
+        //the element and its key are only ever engaged together
+        optional_holder<std::pair<value_type, key_type>> best;
         auto it = _begin;
-        while (it != _end)
-        {
-            resit = it;
-            ++it;
-        }
-        if (resit == _end)
+        linq_push(it, _end, [&best, &keySelector](const auto& value)
+                  {
+                      auto key = keySelector(value);
+                      if (!best.has_value() || (TLargest::value ? best.get().second < key : key < best.get().second))
+                      {
+                          best.emplace(value, std::move(key));
+                      }
+                      return true;
+                  });
+        if (!best.has_value())
         {
-            return v;
+            empty_err();
         }
-        return *resit;
+        return best.get().first;
     }
 
-    linq_collection<TIterator> single() const
+    //contiguous arithmetic sources go through the vectorized kernels
+    template <class TOp>
+    value_type reduce_impl(std::true_type) const
     {
-        auto it = _begin;
-        if (it == _end)
+        if (_begin == _end)
         {
             empty_err();
         }
-        ++it;
-        if (it != _end)
+        return simd_reduce<TOp>(std::addressof(*_begin), static_cast<std::size_t>(_end - _begin));
+    }
+
+    template <class TOp>
+    value_type reduce_impl(std::false_type) const
+    {
+        return aggregate([](const auto& x, const auto& y)
+            {
+                return TOp::apply(x, y);
+            });
+    }
+
+    //the count is never narrowed, integral sums are divided in a type wide enough for it
+    template <class TResult>
+    static TResult divide_by_count(const TResult& sum, std::size_t count, std::true_type)
+    {
+        using wide_type = std::conditional_t<std::is_integral<TResult>::value, std::common_type_t<TResult, long long>, TResult>;
+        return static_cast<TResult>(static_cast<wide_type>(sum) / static_cast<wide_type>(count));
+    }
+
+    template <class TResult>
+    static TResult divide_by_count(const TResult& sum, std::size_t count, std::false_type)
+    {
+        return sum / count;
+    }
+
+    template <class TResult>
+    TResult average_impl(std::true_type) const
+    {
+        auto count = static_cast<std::size_t>(_end - _begin);
+        if (count == 0)
         {
-            throw element_not_unique("more than one element in collection");
+            empty_err();
         }
-        return *this;
+        return divide_by_count<TResult>(simd_reduce<simd_sum>(std::addressof(*_begin), count), count, std::is_arithmetic<TResult>{});
     }
 
-    linq<value_type> single_or_default(const value_type& v) const
+    template <class TResult>
+    TResult average_impl(std::false_type) const
     {
+        TResult sum{};
+        std::size_t count = 0;
         auto it = _begin;
-        if (it == _end)
+        linq_push(it, _end, [&sum, &count](const auto& x)
+                  {
+                      sum += x;
+                      count++;
+                      return true;
+                  });
+        if (count == 0)
         {
-            return from_value(v);
-        }
-        ++it;
-        if (it != _end)
-        {
-            throw element_not_unique("more than one element in collection");
+            empty_err();
         }
-        return *this;
+        return divide_by_count<TResult>(sum, count, std::is_arithmetic<TResult>{});
     }
 
-    template <class TIterator2>
-    bool sequence_equal_impl(const linq_collection<TIterator2>& e) const
+    auto as_parallel_impl(thread_pool& pool, std::true_type) const;
+
+    auto as_parallel_impl(thread_pool& pool, std::false_type) const
     {
-        auto it1 = _begin;
-        auto it1e = _end;
-        auto it2 = e.begin();
-        auto it2e = e.end();
+        return from_shared(std::make_shared<const std::vector<value_type>>(to_vector())).as_parallel(pool);
+    }
 
-        while (it1 != it1e && it2 != it2e)
+    /*
+     * select and where are rewritten here rather than nested:
+     * adjacent predicates and selectors are fused into one iterator,
+     * and count looks through selectors because they never change the number of elements
+     */
+    //the begin and end iterators of a stage share one function_holder
+    template <template <class, class> class TStage, class TSource, class TFunction>
+    static auto stage_impl(TSource begin, TSource end, TFunction&& func)
+    {
+        using iter_type = TStage<TSource, std::decay_t<TFunction>>;
+        function_holder<std::decay_t<TFunction>> holder(std::forward<TFunction>(func));
+        auto sentinel = linq_sentinel(end);
+        return linq_collection<iter_type>{
+            iter_type{std::move(begin), sentinel, holder},
+            iter_type{std::move(end), sentinel, holder}
+        };
+    }
+
+    template <class TSource, class TFunction>
+    static auto select_impl(TSource begin, TSource end, TFunction&& func)
+    {
+        using iter_type = select_iterator<TSource, std::decay_t<TFunction>>;
+        function_holder<std::decay_t<TFunction>> holder(std::forward<TFunction>(func));
+        return linq_collection<iter_type>{
+            iter_type{std::move(begin), holder},
+            iter_type{std::move(end), holder}
+        };
+    }
+
+    template <class TSource, class TFunction1, class TFunction2>
+    static auto select_impl(const select_iterator<TSource, TFunction1>& begin, const select_iterator<TSource, TFunction1>& end, TFunction2&& func)
+    {
+        using selector = fused_selector<TFunction1, std::decay_t<TFunction2>>;
+        return select_impl(begin.source(), end.source(), selector{begin.selector(), std::forward<TFunction2>(func)});
+    }
+
+    template <class TSource, class TFunction>
+    static auto where_impl(TSource begin, TSource end, TFunction&& func)
+    {
+        return stage_impl<where_iterator>(std::move(begin), std::move(end), std::forward<TFunction>(func));
+    }
+
+    template <class TSource, class TFunction1, class TFunction2>
+    static auto where_impl(const where_iterator<TSource, TFunction1>& begin, const where_iterator<TSource, TFunction1>& end, TFunction2&& func)
+    {
+        using predicate = fused_predicate<TFunction1, std::decay_t<TFunction2>>;
+        using iter_type = where_iterator<TSource, predicate>;
+        //begin has already skipped the elements rejected by the first predicate
+        function_holder<predicate> holder(predicate{begin.predicate(), std::forward<TFunction2>(func)});
+        return linq_collection<iter_type>{
+            iter_type{begin.source(), begin.source_end(), holder},
+            iter_type{end.source(), end.source_end(), holder}
+        };
+    }
+
+    template <class TSource>
+    static std::size_t count_impl(const TSource& begin, const TSource& end)
+    {
+        return count_impl(begin, end, is_random_access<TSource>{});
+    }
+
+    template <class TSource, class TFunction>
+    static std::size_t count_impl(const select_iterator<TSource, TFunction>& begin, const select_iterator<TSource, TFunction>& end)
+    {
+        return count_impl(begin.source(), end.source());
+    }
+
+    template <class TSource>
+    static std::size_t count_impl(const TSource& begin, const TSource& end, std::true_type)
+    {
+        return static_cast<std::size_t>(end - begin);
+    }
+
+    template <class TSource>
+    static std::size_t count_impl(const TSource& begin, const TSource& end, std::false_type)
+    {
+        std::size_t c = 0;
+        auto it = begin;
+        linq_push(it, end, [&c](const auto&)
+                  {
+                      c++;
+                      return true;
+                  });
+        return c;
+    }
+
+    //requires a non-empty collection
+    TIterator last_iterator(std::true_type) const
+    {
+        auto it = _end;
+        --it;
+        return it;
+    }
+
+    TIterator last_iterator(std::false_type) const
+    {
+        auto resit = _begin;
+        auto it = _begin;
+        while (it != _end)
         {
-            if (*it1 != *it2)
-            {
-                return false;
-            }
-            ++it1;
-            ++it2;
+            resit = it;
+            ++it;
         }
-        return it1 == it1e && it2 == it2e;
+        return resit;
     }
 
-    template <class TIterator2>
-    auto sequence_equal(const linq_collection<TIterator2>& cont) const
-    -> decltype(sequence_equal_impl(cont))
+    //random access sources are sliced in O(1), keeping the source iterator type
+    self skip_impl(std::size_t count, std::true_type) const
     {
-        return sequence_equal_impl(cont);
+        auto first = _begin;
+        advance_bounded(first, _end, count);
+        return {first, _end};
     }
 
-    template <class TContainer>
-    auto sequence_equal(const TContainer& other) const
-    -> decltype(sequence_equal_impl(from(other)))
+    linq_collection<skip_iterator<TIterator>> skip_impl(std::size_t count, std::false_type) const
     {
-        return sequence_equal_impl(from(other));
+        return {
+            skip_iterator<TIterator>{_begin, linq_sentinel(_end), count},
+            skip_iterator<TIterator>{_end, linq_sentinel(_end), count},
+        };
     }
 
-    template <class T>
-    auto sequence_equal(const std::initializer_list<T>& ilist) const
-    -> decltype(sequence_equal_impl(from(ilist)))
+    self take_impl(std::size_t count, std::true_type) const
     {
-        return sequence_equal_impl(from(ilist));
+        auto last = _begin;
+        advance_bounded(last, _end, count);
+        return {_begin, last};
     }
 
-    linq<value_type> distinct() const
+    linq_collection<take_iterator<TIterator>> take_impl(std::size_t count, std::false_type) const
     {
-        std::set<value_type> s;
-        std::vector<value_type> v;
-        std::for_each(begin(), end(), [&s, &v](const auto& x)
-                      {
-                          if (s.insert(x).second)
-                          {
-                              v.push_back(x);
-                          }
-                      });
+        return {
+            take_iterator<TIterator>{_begin, linq_sentinel(_end), count},
+            take_iterator<TIterator>{_end, linq_sentinel(_end), count}
+        };
+    }
 
-        return from_values(std::move(v));
+    template <class TIterator2>
+    linq_collection<zip_iterator<TIterator, TIterator2>> zip_with_impl(const linq_collection<TIterator2>& e, std::true_type) const
+    {
+        auto n = std::min(count(), e.count());
+        auto last1 = _begin;
+        auto last2 = e.begin();
+        last1 += static_cast<typename std::iterator_traits<TIterator>::difference_type>(n);
+        last2 += static_cast<typename std::iterator_traits<TIterator2>::difference_type>(n);
+        return {
+            zip_iterator<TIterator, TIterator2>{_begin, last1, e.begin(), last2},
+            zip_iterator<TIterator, TIterator2>{last1, last1, last2, last2}
+        };
     }
 
     template <class TIterator2>
-    linq<value_type> except_with_impl(const linq_collection<TIterator2>& e) const
+    linq_collection<zip_iterator<TIterator, TIterator2>> zip_with_impl(const linq_collection<TIterator2>& e, std::false_type) const
     {
-        std::set<value_type> s(e.begin(), e.end());
-        std::vector<value_type> xs;
-        std::for_each(_begin, _end, [&](const value_type& value)
-                      {
-                          if (s.insert(value).second)
-                          {
-                              xs.push_back(value);
-                          }
-                      });
-        return from_values(std::move(xs));
+        return {
+            zip_iterator<TIterator, TIterator2>{_begin, _end, e.begin(), e.end()},
+            zip_iterator<TIterator, TIterator2>{_end, _end, e.end(), e.end()}
+        };
     }
 
+    //sized sources let sinks allocate once
     template <class TContainer>
-    auto except_with(const TContainer& other) const
-    -> decltype(except_with_impl(from(other)))
+    auto reserve_container(TContainer& res, int) const -> decltype(res.reserve(std::size_t()), void())
     {
-        return except_with_impl(from(other));
+        if (is_random_access<TIterator>::value)
+        {
+            res.reserve(count());
+        }
     }
 
-    template <class T>
-    auto except_with(const std::initializer_list<T>& ilist) const
-    -> decltype(except_with_impl(from(ilist)))
+    template <class TContainer>
+    void reserve_container(TContainer&, long) const
     {
-        return except_with_impl(from(ilist));
     }
+};
 
-    template <class TIterator2>
-    auto except_with(const linq_collection<TIterator2>& e) const
-    -> decltype(except_with_impl(e))
+template <typename T>
+class linq : public linq_collection<any_iterator<T>>
+{
+    using base = linq_collection<any_iterator<T>>;
+public:
+    linq()
+        : base(any_iterator<T>(), any_iterator<T>())
     {
-        return except_with_impl(e);
     }
 
-
-    template <class TIterator2,
-              std::enable_if_t<std::is_same<value_type, deref_iter_t<TIterator2>>::value>* = nullptr>
-    linq<value_type> intersect_with_impl(const linq_collection<TIterator2>& e) const
+    template <typename TIterator>
+    linq(const linq_collection<TIterator>& e)
+        : base(any_iterator<T>(e.begin()),
+               any_iterator<T>(e.end())
+        )
     {
-        std::set<value_type> s1, s2(e.begin(), e.end());
-        std::vector<value_type> res;
-        std::for_each(begin(), end(), [&s1, &s2, &res](const value_type& x)
-                      {
-                          if (s1.insert(x).second && !s2.insert(x).second)
-                          {
-                              res.push_back(x);
-                          }
-                      });
-        return from_values(std::move(res));
     }
+};
 
-    template <class TIterator2>
-    auto intersect_with(const linq_collection<TIterator2>& e) const
-    -> decltype(intersect_with_impl(e))
+/*
+ * result of order_by, sorted lazily and stably on first access.
+ * then_by adds a tie-breaking key to the same sort instead of sorting again.
+ */
+template <class TIterator, class TKeySelectors>
+class ordered_linq_collection : public linq_collection<order_by_iterator<order_by_state<TIterator, TKeySelectors>>>
+{
+private:
+    using state_type = order_by_state<TIterator, TKeySelectors>;
+    using iterator_type = order_by_iterator<state_type>;
+    using base = linq_collection<iterator_type>;
+
+    std::shared_ptr<state_type> _state;
+
+    ordered_linq_collection(const std::shared_ptr<state_type>& state)
+        : base(iterator_type(state, false), iterator_type(state, true))
+        , _state(state)
     {
-        return intersect_with_impl(e);
     }
 
-    template <class TContainer>
-    auto intersect_with(const TContainer& other) const
-    -> decltype(intersect_with_impl(from(other)))
+    template <bool Descending, class TFunction>
+    auto then_by_impl(const TFunction& keySelector) const
+    -> ordered_linq_collection<TIterator, decltype(std::tuple_cat(std::declval<const TKeySelectors&>(),
+                                                                  std::make_tuple(order_key<TFunction, Descending>{keySelector})))>
     {
-        return intersect_with_impl(from(other));
+        return {_state->source_begin(), _state->source_end(),
+            std::tuple_cat(_state->selectors(), std::make_tuple(order_key<TFunction, Descending>{keySelector}))};
     }
 
-    template <class T>
-    auto intersect_with(const std::initializer_list<T>& ilist) const
-    -> decltype(intersect_with_impl(from(ilist)))
+public:
+    ordered_linq_collection(const TIterator& begin, const TIterator& end, const TKeySelectors& selectors)
+        : ordered_linq_collection(make_arena_shared<state_type>(begin, end, selectors))
     {
-        return intersect_with_impl(from(ilist));
     }
 
-    template <class TIterator2,
-              std::enable_if_t<std::is_same<value_type, deref_iter_t<TIterator2>>::value>* = nullptr>
-    linq<value_type> union_with_impl(const linq_collection<TIterator2>& e) const
+    template <class TFunction>
+    auto then_by(const TFunction& keySelector) const
+    -> decltype(then_by_impl<false>(keySelector))
     {
-        return concat(e).distinct();
+        return then_by_impl<false>(keySelector);
     }
 
-    template <class TIterator2>
-    auto union_with(const linq_collection<TIterator2>& e) const
-    -> decltype(union_with_impl(e))
+    template <class TFunction>
+    auto then_by_descending(const TFunction& keySelector) const
+    -> decltype(then_by_impl<true>(keySelector))
     {
-        return union_with_impl(e);
+        return then_by_impl<true>(keySelector);
     }
 
-    template <class TContainer>
-    auto union_with(const TContainer& other) const
-    -> decltype(union_with_impl(from(other)))
+    //selects the first count elements with a bounded heap instead of sorting the whole source
+    linq_collection<iterator_type> take(std::size_t count) const
     {
-        return union_with_impl(from(other));
+        auto state = make_arena_shared<state_type>(_state->source_begin(), _state->source_end(), _state->selectors(),
+                                                  std::min(count, _state->limit()));
+        return {iterator_type(state, false), iterator_type(state, true)};
     }
 
-    template <class T>
-    auto union_with(const std::initializer_list<T>& ilist) const
-    -> decltype(union_with_impl(from(ilist)))
+    typename base::value_type first() const
     {
-        return union_with_impl(from(ilist));
+        return take(1).first();
     }
 
-    template <class TFunction>
-    value_type aggregate(const TFunction& f) const
+    typename base::value_type first_or_default(const typename base::value_type& v) const
     {
-        if (empty())
-        {
-            empty_err();
-        }
-        auto it = _begin;
-        value_type res = *it;
-        ++it;
-        std::for_each(it, _end, [&res, &f](const value_type& x)
-                      {
-                          res = f(res, x);
-                      });
-        return res;
+        return take(1).first_or_default(v);
     }
+};
 
-    template <class TResult, class TFunction>
-    TResult aggregate(const TResult& init, const TFunction& f) const
-    {
-        TResult res = init;
-        for (auto it = _begin; it != _end; ++it)
+template <class T>
+static linq<T> flatten(const linq<linq<T>>& xs)
+{
+    return xs.select_many([](const linq<T>& ys)
         {
-            res = f(res, *it);
-        }
-        return res;
-    }
+            return ys;
+        });
+}
 
-    template <class TFunction>
-    bool all(const TFunction& f) const
+/*
+ * work stealing pool: every worker owns a deque, pushes and pops its own tasks at the back
+ * and steals the oldest, largest tasks from the front of the others when it runs dry.
+ * Threads outside the pool share one extra deque and help running tasks while they wait,
+ * so nested parallel queries cannot starve the pool.
+ */
+class thread_pool
+{
+private:
+    using task_type = std::function<void()>;
+
+    struct task_queue
     {
-        return select(f).aggregate(true, [](bool a, bool b)
-                                   {
-                                       return a && b;
-                                   });
-    }
+        std::mutex mutex;
+        std::deque<task_type> tasks;
+    };
 
-    template <class TFunction>
-    bool any(const TFunction& f) const
+    struct current_worker
     {
-        return !where(f).empty();
-    }
+        const thread_pool* pool;
+        std::size_t index;
+    };
 
-    template <class TResult>
-    TResult average() const
+    //a range of indices split across tasks, finished once every index was handed to body
+    struct range_job
     {
-        if (empty())
-        {
-            empty_err();
-        }
-        TResult sum{};
-        int counter = 0;
-        std::for_each(_begin, _end, [&sum, &counter](const value_type& x)
-                      {
-                          sum += x;
-                          counter++;
-                      });
-        return sum / counter;
-    }
+        std::size_t count;
+        std::size_t grain;
+        std::size_t finished;
+        std::atomic<bool> failed;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
 
-    value_type max() const
+    //the last queue is shared by threads outside the pool
+    std::vector<std::unique_ptr<task_queue>> _queues;
+    std::vector<std::thread> _workers;
+    std::atomic<std::size_t> _pending;
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    bool _stopping;
+
+    static current_worker& current()
     {
-        return aggregate([](const auto& x, const auto& y)
-            {
-                return x > y ? x : y;
-            });
+        static thread_local current_worker worker = {nullptr, 0};
+        return worker;
     }
 
-    value_type min() const
+    std::size_t queue_index() const
     {
-        return aggregate([](const auto& x, const auto& y)
-            {
-                return x < y ? x : y;
-            });
+        auto& worker = current();
+        return worker.pool == this ? worker.index : _workers.size();
     }
 
-    value_type sum() const
+    void push(task_type&& task)
     {
-        return aggregate([](const auto& x, const auto& y)
-            {
-                return x + y;
-            });
+        auto& queue = *_queues[queue_index()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++_pending;
+        }
+        _ready.notify_one();
     }
 
-    value_type product() const
+    bool try_pop(task_queue& queue, bool back, task_type& task)
     {
-        return aggregate([](const auto& x, const auto& y)
-            {
-                return x + y;
-            });
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            return false;
+        }
+        if (back)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        --_pending;
+        return true;
     }
 
-
-    template <typename TFunction>
-    auto select_many(const TFunction& f) const
-    -> linq<decltype(*f(std::declval<value_type>()).begin())>
+    bool try_run_one()
     {
-        using collection_type = decltype(f(std::declval<value_type>()));
-        using collection_value_type = decltype(*f(std::declval<value_type>()).begin());
+        task_type task;
+        auto own = queue_index();
+        bool found = try_pop(*_queues[own], true, task);
+        for (std::size_t i = 1; !found && i < _queues.size(); i++)
+        {
+            found = try_pop(*_queues[(own + i) % _queues.size()], false, task);
+        }
+        if (found)
+        {
+            task();
+        }
+        return found;
+    }
 
-        return select(f).aggregate(from_empty<collection_value_type>(),
-                                   [](const linq<collection_value_type>& a, const collection_type& b)
-                                   {
-                                       return a.concat(b);
-                                   });
+    void work(std::size_t index)
+    {
+        current() = {this, index};
+        for (;;)
+        {
+            if (try_run_one())
+            {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            _ready.wait(lock, [this]() { return _stopping || _pending != 0; });
+            if (_stopping && _pending == 0)
+            {
+                return;
+            }
+        }
     }
 
+    //splits off the upper halves as stealable tasks until the range is small enough
     template <class TFunction>
-    auto group_by(const TFunction& keySelector) const
-    -> linq<std::pair<typename callable_traits<TFunction>::return_type, linq<value_type>>>
+    void run_range(const std::shared_ptr<range_job>& job, std::size_t begin, std::size_t end, const TFunction& body)
     {
-        using key_type = typename callable_traits<TFunction>::return_type;
-        using value_vector = std::vector<value_type>;
+        while (end - begin > job->grain)
+        {
+            auto middle = begin + (end - begin) / 2;
+            push([this, job, middle, end, &body]() { run_range(job, middle, end, body); });
+            end = middle;
+        }
 
-        std::map<key_type, value_vector> m;
-        for (const auto& elm : *this)
+        //after a failure the remaining ranges are only counted as finished
+        std::exception_ptr error;
+        if (!job->failed)
         {
-            auto key = keySelector(elm);
-            auto iter = m.find(key);
-            if (iter == m.end())
+            try
             {
-                m[key].push_back(elm);
+                body(begin, end);
             }
-            else
+            catch (...)
             {
-                iter->second.push_back(elm);
+                error = std::current_exception();
+                job->failed = true;
             }
         }
-
-        std::vector<std::pair<key_type, linq<value_type>>> res;
-        for (const auto& p : m)
+        std::lock_guard<std::mutex> lock(job->mutex);
+        if (error && !job->error)
         {
-            res.push_back({p.first, from_values(std::move(p.second))});
+            job->error = error;
+        }
+        job->finished += end - begin;
+        if (job->finished == job->count)
+        {
+            job->done.notify_all();
         }
-        return from_values(std::move(res));
     }
 
-    template <class TIterator2, class TFunction1, class TFunction2>
-    auto full_join_impl(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
-    -> linq<std::tuple<std::remove_reference_t<typename callable_traits<TFunction1>::return_type>,
-                       linq<std::decay_t<deref_iter_t<TIterator>>>,
-                       linq<std::decay_t<deref_iter_t<TIterator2>>>>>
+public:
+    explicit thread_pool(std::size_t threads = std::max(std::thread::hardware_concurrency(), 2u) - 1)
+        : _pending(0)
+        , _stopping(false)
     {
-        using key_type = std::remove_reference_t<typename callable_traits<TFunction1>::return_type>;
-        using value_type1 = std::decay_t<deref_iter_t<TIterator>>;
-        using value_type2 = std::decay_t<deref_iter_t<TIterator2>>;
-        using full_join_pair_t = std::tuple<key_type, linq<value_type1>, linq<value_type2>>;
+        for (std::size_t i = 0; i <= threads; i++)
+        {
+            _queues.push_back(std::make_unique<task_queue>());
+        }
+        for (std::size_t i = 0; i < threads; i++)
+        {
+            _workers.emplace_back([this, i]() { work(i); });
+        }
+    }
 
-        std::multimap<key_type, value_type1> map1;
-        std::multimap<key_type, value_type2> map2;
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
 
-        std::for_each(_begin, _end, [&map1, &keySelector1](const value_type1& value)
-                      {
-                          map1.insert({keySelector1(value), value});
-                      });
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _ready.notify_all();
+        for (auto& worker : _workers)
+        {
+            worker.join();
+        }
+    }
 
-        std::for_each(e.begin(), e.end(), [&map2, &keySelector2](const value_type2& value)
-                      {
-                          map2.insert({keySelector2(value), value});
-                      });
+    static thread_pool& default_pool()
+    {
+        static thread_pool pool;
+        return pool;
+    }
 
-        std::vector<full_join_pair_t> result;
-        auto lower1 = map1.begin();
-        auto lower2 = map2.begin();
+    //number of threads working on a query, the calling thread included
+    std::size_t concurrency() const
+    {
+        return _workers.size() + 1;
+    }
 
-        while (lower1 != map1.end() && lower2 != map2.end())
+    /*
+     * calls body(begin, end) on disjoint ranges covering [0, count), none longer than grain
+     * unless grain is 0, and returns after all of them finished.
+     * Ranges are split in halves so idle workers can steal large pieces first.
+     */
+    template <class TFunction>
+    void for_each_range(std::size_t count, std::size_t grain, const TFunction& body)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        auto job = std::make_shared<range_job>();
+        job->count = count;
+        job->grain = std::max<std::size_t>(grain, 1);
+        job->finished = 0;
+        job->failed = false;
+
+        run_range(job, 0, count, body);
+        for (;;)
         {
-            auto& key1 = lower1->first;
-            auto& key2 = lower2->first;
-            auto upper1 = map1.upper_bound(key1);
-            auto upper2 = map2.upper_bound(key2);
-
-            if (key1 < key2)
-            {
-                std::vector<value_type1> outers;
-                std::for_each(lower1, upper1, [&outers](const std::pair<key_type, value_type1>& it)
-                              {
-                                  outers.push_back(it.second);
-                              });
-                lower1 = upper1;
-                result.emplace_back(key1, from_values(std::move(outers)), from_empty<value_type2>());
-            }
-            else if (key1 > key2)
             {
-                std::vector<value_type2> inners;
-                std::for_each(lower2, upper2, [&inners](const std::pair<key_type, value_type2>& it)
-                              {
-                                  inners.push_back(it.second);
-                              });
-                lower2 = upper2;
-                result.emplace_back(key2, from_empty<value_type1>(), from_values(std::move(inners)));
+                std::lock_guard<std::mutex> lock(job->mutex);
+                if (job->finished == job->count)
+                {
+                    break;
+                }
             }
-            else
+            //help with any queued task instead of blocking while work is available
+            if (!try_run_one())
             {
-                std::vector<value_type1> outers;
-                std::for_each(lower1, upper1, [&outers](const std::pair<key_type, value_type1>& it)
-                              {
-                                  outers.push_back(it.second);
-                              });
-                std::vector<value_type2> inners;
-                std::for_each(lower2, upper2, [&inners](const std::pair<key_type, value_type2>& it)
-                              {
-                                  inners.push_back(it.second);
-                              });
-                lower1 = upper1;
-                lower2 = upper2;
-                result.emplace_back(key1, from_values(std::move(outers)), from_values(std::move(inners)));
+                std::unique_lock<std::mutex> lock(job->mutex);
+                job->done.wait_for(lock, std::chrono::milliseconds(1), [&job]() { return job->finished == job->count; });
             }
         }
-        return from_values(std::move(result));
+        if (job->error)
+        {
+            std::rethrow_exception(job->error);
+        }
     }
+};
 
-    template <class TIterator2, class TFunction1, class TFunction2>
-    auto full_join(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
-    -> decltype(full_join_impl(e, keySelector1, keySelector2))
-    {
-        return full_join_impl(e, keySelector1, keySelector2);
-    }
+//a random access source split by element index
+template <class TIterator>
+class range_partition
+{
+private:
+    TIterator _begin;
+    TIterator _end;
 
-    template <class TContainer, class TFunction1, class TFunction2>
-    auto full_join(const TContainer& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
-    -> decltype(full_join_impl(from(e), keySelector1, keySelector2))
+public:
+    using collection_type = linq_collection<TIterator>;
+
+    range_partition(const TIterator& begin, const TIterator& end)
+        : _begin(begin)
+        , _end(end)
     {
-        return full_join_impl(from(e), keySelector1, keySelector2);
     }
 
-    template <class T, class TFunction1, class TFunction2>
-    auto full_join(const std::initializer_list<T>& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
-    -> decltype(full_join_impl(from(e), keySelector1, keySelector2))
+    std::size_t size() const
     {
-        return full_join_impl(from(e), keySelector1, keySelector2);
+        return static_cast<std::size_t>(_end - _begin);
     }
 
-    template <class TIterator2, class TFunction1, class TFunction2>
-    auto group_join_impl(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
-    -> linq<std::tuple<std::remove_reference_t<decltype(keySelector1(std::declval<value_type>()))>,
-                       std::decay_t<deref_iter_t<TIterator>>,
-                       linq<std::decay_t<deref_iter_t<TIterator2>>>>>
+    std::size_t min_grain() const
     {
-        using key_type = std::remove_reference_t<decltype(keySelector1(std::declval<value_type>()))>;
-        using value_type1 = std::decay_t<deref_iter_t<TIterator>>;
-        using value_type2 = std::decay_t<deref_iter_t<TIterator2>>;
-        using full_join_pair_t = std::tuple<key_type, linq<value_type1>, linq<value_type2>>;
-        using group_join_pair_t = std::tuple<key_type, value_type1, linq<value_type2>>;
+        return 1;
+    }
 
-        auto f = full_join(e, keySelector1, keySelector2);
-        auto g = f.select_many([](const full_join_pair_t& item) -> linq<group_join_pair_t>
-            {
-                const auto& outers = std::get<1>(item);
-                //MUST CAPTURE item BY VALUE
-                return outers.select([item](const value_type1& outer) -> group_join_pair_t
-                    {
-                        return {std::get<0>(item), outer, std::get<2>(item)};
-                    });
-            });
-        return g;
+    collection_type chunk(std::size_t first, std::size_t last) const
+    {
+        using difference_type = typename std::iterator_traits<TIterator>::difference_type;
+        return {std::next(_begin, static_cast<difference_type>(first)), std::next(_begin, static_cast<difference_type>(last))};
     }
+};
 
-    template <class TIterator2, class TFunction1, class TFunction2>
-    auto group_join(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
-    -> decltype(group_join_impl(e, keySelector1, keySelector2))
+/*
+ * a text file split by byte offset, every chunk opens the file on its own and reads
+ * the lines that start in its range, so a line crossing a boundary belongs to the earlier chunk
+ */
+class file_lines_partition
+{
+private:
+    std::string _path;
+    std::size_t _size;
+    std::size_t _block_size;
+
+    std::unique_ptr<std::istream> open() const
     {
-        return group_join_impl(e, keySelector1, keySelector2);
+        std::unique_ptr<std::istream> stream(new std::ifstream(_path, std::ios::in | std::ios::binary));
+        if (!*stream)
+        {
+            throw file_not_readable("cannot open " + _path);
+        }
+        return stream;
     }
 
-    template <class TContainer, class TFunction1, class TFunction2>
-    auto group_join(const TContainer& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
-    -> decltype(group_join_impl(from(e), keySelector1, keySelector2))
+public:
+    using collection_type = linq_collection<line_iterator>;
+
+    file_lines_partition(const std::string& path, std::size_t block_size)
+        : _path(path)
+        , _size(0)
+        , _block_size(std::max<std::size_t>(block_size, 1))
     {
-        return group_join_impl(from(e), keySelector1, keySelector2);
+        auto stream = open();
+        stream->seekg(0, std::ios::end);
+        _size = static_cast<std::size_t>(stream->tellg());
     }
 
-    template <class T, class TFunction1, class TFunction2>
-    auto group_join(const std::initializer_list<T>& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
-    -> decltype(group_join_impl(from(e), keySelector1, keySelector2))
+    std::size_t size() const
     {
-        return group_join_impl(from(e), keySelector1, keySelector2);
+        return _size;
     }
 
-    template <class TIterator2, class TFunction1, class TFunction2>
-    auto join_impl(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
-    -> linq<std::tuple<std::remove_reference_t<decltype(keySelector1(std::declval<value_type>()))>,
-                       std::decay_t<deref_iter_t<TIterator>>,
-                       std::decay_t<deref_iter_t<TIterator2>>>>
+    //a chunk smaller than a block would cost more in opening the file than in scanning it
+    std::size_t min_grain() const
     {
-        using key_type = std::remove_reference_t<decltype(keySelector1(std::declval<value_type>()))>;
-        using value_type1 = std::decay_t<deref_iter_t<TIterator>>;
-        using value_type2 = std::decay_t<deref_iter_t<TIterator2>>;
-        using group_join_pair_t = std::tuple<key_type, value_type1, linq<value_type2>>;
-        using join_pair_t = std::tuple<key_type, value_type1, value_type2>;
+        return _block_size;
+    }
 
-        auto g = group_join(e, keySelector1, keySelector2);
-        auto j = g.select_many([](const group_join_pair_t& item)-> linq<join_pair_t>
-            {
-                const linq<value_type2>& inners = std::get<2>(item);
-                return inners.select([item](const value_type2& inner)-> join_pair_t
-                    {
-                        return {std::get<0>(item), std::get<1>(item), inner};
-                    });
-            });
-        return j;
+    collection_type chunk(std::size_t first, std::size_t last) const
+    {
+        //starting one byte early finds out whether first is the start of a line
+        std::size_t start = first == 0 ? 0 : first - 1;
+        auto stream = open();
+        stream->seekg(static_cast<std::streamoff>(start));
+        auto reader = std::make_shared<line_reader>(std::move(stream), _block_size, first != 0, last - start);
+        return {line_iterator(reader), line_iterator()};
     }
+};
 
-    template <class TIterator2, class TFunction1, class TFunction2>
-    auto join(const linq_collection<TIterator2>& e, const TFunction1& keySelector1, const TFunction2& keySelector2) const
-    -> decltype(join_impl(e, keySelector1, keySelector2))
+struct parallel_source_stage
+{
+    template <class TCollection>
+    const TCollection& operator()(const TCollection& source) const
     {
-        return join_impl(e, keySelector1, keySelector2);
+        return source;
     }
+};
 
-    template <class TContainer, class TFunction1, class TFunction2>
-    auto join(const TContainer& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
-    -> decltype(join_impl(from(e), keySelector1, keySelector2))
+template <class TStage, class TFunction>
+struct parallel_where_stage
+{
+    TStage stage;
+    TFunction func;
+
+    template <class TCollection>
+    auto operator()(const TCollection& source) const
     {
-        return join_impl(from(e), keySelector1, keySelector2);
+        return stage(source).where(func);
     }
+};
 
-    template <class T, class TFunction1, class TFunction2>
-    auto join(const std::initializer_list<T>& e, const TFunction1 keySelector1, const TFunction2 keySelector2) const
-    -> decltype(join_impl(from(e), keySelector1, keySelector2))
+template <class TStage, class TFunction>
+struct parallel_select_stage
+{
+    TStage stage;
+    TFunction func;
+
+    template <class TCollection>
+    auto operator()(const TCollection& source) const
     {
-        return join_impl(from(e), keySelector1, keySelector2);
+        return stage(source).select(func);
     }
+};
 
-    template <class TFunction>
-    auto first_order_by(const TFunction& keySelector) const
-    -> linq<linq<value_type>>
+template <class TStage, class TFunction>
+struct parallel_select_many_stage
+{
+    TStage stage;
+    TFunction func;
+
+    template <class TCollection>
+    auto operator()(const TCollection& source) const
     {
-        using key_type = std::decay_t<decltype(keySelector(std::declval<value_type>()))>;
-        return group_by(keySelector).select([](const std::pair<key_type, linq<value_type>>& pair)
-            {
-                return pair.second;
-            });
+        return stage(source).select_many(func);
     }
+};
 
-    template <class TFunction>
-    auto then_order_by(const TFunction& keySelector) const
-    -> linq<value_type>
+/*
+ * query over a source split into chunks, a random access range or a file.
+ * Chunks are split recursively and balanced by the pool's work stealing.
+ * Every chunk runs the stage chain sequentially, the partial results are combined
+ * in chunk order (ordered mode, the default) or as chunks complete (unordered mode).
+ * Functions passed to a parallel query are called from several threads at once.
+ */
+template <class TPartition, class TStage>
+class parallel_query
+{
+private:
+    using self = parallel_query<TPartition, TStage>;
+    using source_type = typename TPartition::collection_type;
+    using collection_type = std::decay_t<decltype(std::declval<const TStage&>()(std::declval<const source_type&>()))>;
+public:
+    using value_type = typename collection_type::value_type;
+private:
+    TPartition _source;
+    TStage _stage;
+    thread_pool* _pool;
+    bool _ordered;
+    std::size_t _grain;
+    bool _irregular;
+
+    template <class TPartition2, class TStage2>
+    friend class parallel_query;
+
+    std::size_t grain() const
     {
-        return select_many([&keySelector](const value_type& values)
-            {
-                return values.first_order_by(keySelector);
-            });
+        //a bounded number of leaf ranges per thread, more for stages with uneven cost per element
+        auto size = _source.size();
+        return _grain != 0 ? _grain : std::max(size / (_pool->concurrency() * (_irregular ? 64 : 8)) + 1, _source.min_grain());
     }
 
     template <class TFunction>
-    auto order_by(const TFunction& keySelector) const
-    -> linq<value_type>
+    void for_each_chunk(const TFunction& body) const
     {
-        return first_order_by(keySelector).select_many([](const linq<value_type>& values)
-            {
-                return values;
-            });
+        _pool->for_each_range(_source.size(), grain(), [this, &body](std::size_t first, std::size_t last)
+                              {
+                                  body(_stage(_source.chunk(first, last)), first);
+                              });
     }
 
-    template <class TIterator2>
-    auto zip_with_impl(const linq_collection<TIterator2>& e) const
-    -> linq_collection<zip_iterator<TIterator, TIterator2>>
+    //chunk(collection, partial) fills the partial result of one chunk
+    template <class TResult, class TChunk, class TCombine>
+    optional_holder<TResult> reduce(const TChunk& chunk, const TCombine& combine) const
     {
-        return {
-            zip_iterator<TIterator, TIterator2>{_begin, _end, e.begin(), e.end()},
-            zip_iterator<TIterator, TIterator2>{_end, _end, e.end(), e.end()}
-        };
+        optional_holder<TResult> result;
+        auto merge = [&result, &combine](TResult&& partial)
+            {
+                if (result.has_value())
+                {
+                    result.emplace(combine(std::move(result.get()), std::move(partial)));
+                }
+                else
+                {
+                    result.emplace(std::move(partial));
+                }
+            };
+
+        std::mutex mutex;
+        if (_ordered)
+        {
+            //chunks are created dynamically, remember where each one started, empty partials are dropped
+            std::vector<std::pair<std::size_t, TResult>> partials;
+            for_each_chunk([&mutex, &partials, &chunk](const collection_type& c, std::size_t first)
+                           {
+                               optional_holder<TResult> partial;
+                               chunk(c, partial);
+                               if (partial.has_value())
+                               {
+                                   std::lock_guard<std::mutex> lock(mutex);
+                                   partials.emplace_back(first, std::move(partial.get()));
+                               }
+                           });
+            std::sort(partials.begin(), partials.end(), [](const auto& a, const auto& b)
+                      {
+                          return a.first < b.first;
+                      });
+            for (auto& partial : partials)
+            {
+                merge(std::move(partial.second));
+            }
+        }
+        else
+        {
+            for_each_chunk([&mutex, &merge, &chunk](const collection_type& c, std::size_t)
+                           {
+                               optional_holder<TResult> partial;
+                               chunk(c, partial);
+                               if (partial.has_value())
+                               {
+                                   std::lock_guard<std::mutex> lock(mutex);
+                                   merge(std::move(partial.get()));
+                               }
+                           });
+        }
+        return result;
     }
 
-    template <class TIterator2>
-    auto zip_with(const linq_collection<TIterator2>& e) const
-    -> decltype(zip_with_impl(e))
-    {
-        return zip_with_impl(e);
+    template <class TFunction>
+    value_type reduce_nonempty(const TFunction& f) const
+    {
+        auto result = reduce<value_type>([&f](const collection_type& c, optional_holder<value_type>& partial)
+                                         {
+                                             if (!c.empty())
+                                             {
+                                                 partial.emplace(c.aggregate(f));
+                                             }
+                                         }, f);
+        if (!result.has_value())
+        {
+            throw collection_empty("collection empty");
+        }
+        return std::move(result.get());
     }
 
-    template <class TContainer>
-    auto zip_with(const TContainer& other) const
-    -> decltype(zip_with_impl(from(other)))
+    template <class TStage2>
+    parallel_query<TPartition, TStage2> with_stage(const TStage2& stage, bool irregular = false) const
     {
-        return zip_with_impl(from(other));
+        parallel_query<TPartition, TStage2> result(_source, stage, *_pool);
+        result._ordered = _ordered;
+        result._grain = _grain;
+        result._irregular = _irregular || irregular;
+        return result;
     }
 
-    template <class T>
-    auto zip_with(const std::initializer_list<T>& ilist) const
-    -> decltype(zip_with_impl(from(ilist)))
+public:
+    parallel_query(const TPartition& source, const TStage& stage, thread_pool& pool)
+        : _source(source)
+        , _stage(stage)
+        , _pool(&pool)
+        , _ordered(true)
+        , _grain(0)
+        , _irregular(false)
     {
-        return zip_with_impl(from(ilist));
     }
 
-    template <class TContainer>
-    TContainer to_container() const
+    //results keep the source order, this is the default
+    self as_ordered() const
     {
-        return TContainer{_begin, _end};
+        self result = *this;
+        result._ordered = true;
+        return result;
     }
 
-    auto to_vector() const
+    //results are combined as soon as chunks complete, in no particular order
+    self as_unordered() const
     {
-        return to_container<std::vector<value_type>>();
+        self result = *this;
+        result._ordered = false;
+        return result;
     }
 
-    auto to_deque() const
+    //largest number of source elements (bytes for files) one task works on, 0 picks it from the source size
+    self with_grain(std::size_t grain) const
     {
-        return to_container<std::deque<value_type>>();
+        self result = *this;
+        result._grain = grain;
+        return result;
     }
 
-    auto to_list() const
+    template <class TFunction>
+    auto where(const TFunction& f) const
     {
-        return to_container<std::list<value_type>>();
+        return with_stage(parallel_where_stage<TStage, TFunction>{_stage, f});
     }
 
-    template <class TContainer, class TFunction>
-    TContainer to_key_value_container(const TFunction& keySelector) const
+    template <class TFunction>
+    auto select(const TFunction& f) const
     {
-        auto g = select(keySelector).zip_with(*this);
-        return {g.begin(), g.end()};
+        return with_stage(parallel_select_stage<TStage, TFunction>{_stage, f});
     }
 
+    //the cost of one source element may vary a lot here, so the source is split finer
     template <class TFunction>
-    auto to_map(const TFunction& keySelector)
+    auto select_many(const TFunction& f) const
     {
-        return to_key_value_container<std::map<typename callable_traits<TFunction>::return_type, value_type>>(keySelector);
+        return with_stage(parallel_select_many_stage<TStage, TFunction>{_stage, f}, true);
     }
 
+    //f combines partial results as well, so it has to be associative
     template <class TFunction>
-    auto to_multimap(const TFunction& keySelector)
+    value_type aggregate(const TFunction& f) const
     {
-        return to_key_value_container<std::multimap<typename callable_traits<TFunction>::return_type, value_type>>(keySelector);
+        return reduce_nonempty(f);
     }
 
-    template <class TFunction>
-    auto to_unordered_map(const TFunction& keySelector)
+    template <class TResult, class TFunction, class TCombine>
+    TResult aggregate(const TResult& init, const TFunction& f, const TCombine& combine) const
     {
-        return to_key_value_container<std::unordered_map<typename callable_traits<TFunction>::return_type, value_type>>(keySelector);
+        auto result = reduce<TResult>([&init, &f](const collection_type& c, optional_holder<TResult>& partial)
+                                      {
+                                          partial.emplace(c.aggregate(init, f));
+                                      }, combine);
+        return result.has_value() ? std::move(result.get()) : init;
     }
 
-    template <class TFunction>
-    auto to_unordered_multimap(const TFunction& keySelector)
+    value_type sum() const
     {
-        return to_key_value_container<std::unordered_multimap<typename callable_traits<TFunction>::return_type, value_type>>(keySelector);
+        return reduce_nonempty([](const auto& x, const auto& y)
+            {
+                return x + y;
+            });
     }
 
-    auto to_set()
+    value_type max() const
     {
-        return to_container<std::set<value_type>>();
+        return reduce_nonempty([](const auto& x, const auto& y)
+            {
+                return x > y ? x : y;
+            });
     }
 
-    auto to_multiset()
+    value_type min() const
     {
-        return to_key_value_container<std::multiset<value_type>>();
+        return reduce_nonempty([](const auto& x, const auto& y)
+            {
+                return x < y ? x : y;
+            });
     }
 
-    auto to_unordered_set()
+    std::size_t count() const
     {
-        return to_key_value_container<std::unordered_set<value_type>>();
+        auto result = reduce<std::size_t>([](const collection_type& c, optional_holder<std::size_t>& partial)
+                                          {
+                                              partial.emplace(c.count());
+                                          }, std::plus<std::size_t>());
+        return result.has_value() ? result.get() : 0;
     }
 
-    auto to_unordered_multiset()
+    /*
+     * groups every chunk on its own and merges the groups of later chunks into the earlier ones,
+     * in ordered mode keys and elements keep their sequential order.
+     * Select owned values before grouping the lines of a file, line views do not outlive their chunk
+     */
+    template <class TFunction>
+    auto group_by(const TFunction& keySelector) const
+    -> linq<std::pair<std::decay_t<decltype(keySelector(std::declval<value_type>()))>, linq<value_type>>>
     {
-        return to_key_value_container<std::unordered_multiset<value_type>>();
+        using key_type = std::decay_t<decltype(keySelector(std::declval<value_type>()))>;
+        using value_vector = arena_vector<value_type>;
+        using group_vector = arena_vector<std::pair<key_type, value_vector>>;
+
+        auto result = reduce<group_vector>([&keySelector](const collection_type& c, optional_holder<group_vector>& partial)
+                                           {
+                                               hash_groups<key_type, value_vector> index;
+                                               auto iter = c.begin();
+                                               linq_push(iter, c.end(), [&index, &keySelector](const auto& value)
+                                                         {
+                                                             index.find_or_add(keySelector(value), []() { return value_vector(); }).push_back(value);
+                                                             return true;
+                                                         });
+                                               partial.emplace(index.release());
+                                           },
+                                           [](group_vector&& xs, group_vector&& ys)
+                                           {
+                                               arena_unordered_map<key_type, std::size_t> positions;
+                                               for (std::size_t i = 0; i < xs.size(); i++)
+                                               {
+                                                   positions.emplace(xs[i].first, i);
+                                               }
+                                               for (auto& group : ys)
+                                               {
+                                                   auto iter = positions.find(group.first);
+                                                   if (iter == positions.end())
+                                                   {
+                                                       xs.push_back(std::move(group));
+                                                       continue;
+                                                   }
+                                                   auto& values = xs[iter->second].second;
+                                                   values.insert(values.end(), std::make_move_iterator(group.second.begin()), std::make_move_iterator(group.second.end()));
+                                               }
+                                               return std::move(xs);
+                                           });
+
+        std::shared_ptr<const group_vector> groups = make_arena_shared<group_vector>(result.has_value() ? std::move(result.get()) : group_vector());
+        arena_vector<std::pair<key_type, linq<value_type>>> res;
+        res.reserve(groups->size());
+        for (const auto& p : *groups)
+        {
+            res.emplace_back(p.first, from_shared(std::shared_ptr<const value_vector>(groups, &p.second)));
+        }
+        return from_values(std::move(res));
     }
 
-private:
-    [[noreturn]]
+    //stops every chunk as soon as one element matched
+    template <class TFunction>
+    bool any(const TFunction& f) const
+    {
+        std::atomic<bool> found(false);
+        for_each_chunk([&found, &f](const collection_type& c, std::size_t)
+                       {
+                           auto it = c.begin();
+                           linq_push(it, c.end(), [&found, &f](const auto& x)
+                                     {
+                                         if (found.load(std::memory_order_relaxed))
+                                         {
+                                             return false;
+                                         }
+                                         if (f(x))
+                                         {
+                                             found = true;
+                                             return false;
+                                         }
+                                         return true;
+                                     });
+                       });
+        return found;
+    }
 
-    static void empty_err()
+    bool any() const
     {
-        throw collection_empty("collection empty");
+        return any([](const value_type&) { return true; });
     }
-};
 
-template <typename T>
-class linq : public linq_collection<any_iterator<T>>
-{
-    using base = linq_collection<any_iterator<T>>;
-public:
-    linq()
-        : linq_collection<any_iterator<T>>()
+    template <class TFunction>
+    bool all(const TFunction& f) const
     {
+        return !any([&f](const value_type& x) { return !f(x); });
     }
 
-    template <typename TIterator>
-    linq(const linq_collection<TIterator>& e)
-        : base(any_iterator<T>(e.begin()),
-               any_iterator<T>(e.end())
-        )
+    std::vector<value_type> to_vector() const
     {
+        auto result = reduce<std::vector<value_type>>([](const collection_type& c, optional_holder<std::vector<value_type>>& partial)
+                                                      {
+                                                          partial.emplace(c.to_vector());
+                                                      },
+                                                      [](std::vector<value_type>&& xs, std::vector<value_type>&& ys)
+                                                      {
+                                                          xs.insert(xs.end(), std::make_move_iterator(ys.begin()), std::make_move_iterator(ys.end()));
+                                                          return std::move(xs);
+                                                      });
+        return result.has_value() ? std::move(result.get()) : std::vector<value_type>();
     }
 };
 
-template <class T>
-static linq<T> flatten(const linq<linq<T>>& xs)
+template <class TIterator>
+auto linq_collection<TIterator>::as_parallel_impl(thread_pool& pool, std::true_type) const
 {
-    return xs.select_many([](const linq<T>& ys)
-        {
-            return ys;
-        });
+    return parallel_query<range_partition<TIterator>, parallel_source_stage>{range_partition<TIterator>(_begin, _end), parallel_source_stage(), pool};
+}
+
+template <class TIterator>
+auto linq_collection<TIterator>::as_parallel() const
+{
+    return as_parallel(thread_pool::default_pool());
 }
 
 template <class TContainer>
@@ -1662,5 +6989,150 @@ auto from(const TIterator& a, const TIterator& b) -> linq_collection<TIterator>
 {
     return {a, b};
 }
+
+/*
+ * lines of a stream, read block_size bytes at a time.
+ * The query is single pass and every line_view is only valid until the query moves to the next line,
+ * convert lines to std::string before materializing them
+ */
+inline linq_collection<line_iterator> from_lines(std::istream& stream, std::size_t block_size = line_reader::default_block_size)
+{
+    return {line_iterator(std::make_shared<line_reader>(stream, block_size)), line_iterator()};
+}
+
+inline linq_collection<line_iterator> from_file_lines(const std::string& path, std::size_t block_size = line_reader::default_block_size)
+{
+    std::unique_ptr<std::istream> file(new std::ifstream(path, std::ios::in | std::ios::binary));
+    if (!*file)
+    {
+        throw file_not_readable("cannot open " + path);
+    }
+    return {line_iterator(std::make_shared<line_reader>(std::move(file), block_size)), line_iterator()};
+}
+
+/*
+ * lines of a text file scanned by several threads, every thread reads its own byte range.
+ * Ordered results match from_file_lines, line views are only valid inside the query
+ */
+inline parallel_query<file_lines_partition, parallel_source_stage> from_file_lines_parallel(const std::string& path, thread_pool& pool, std::size_t block_size = line_reader::default_block_size)
+{
+    return {file_lines_partition(path, block_size), parallel_source_stage(), pool};
+}
+
+inline parallel_query<file_lines_partition, parallel_source_stage> from_file_lines_parallel(const std::string& path, std::size_t block_size = line_reader::default_block_size)
+{
+    return from_file_lines_parallel(path, thread_pool::default_pool(), block_size);
+}
+
+#ifdef PL_LINQ_HAS_COROUTINES
+/*
+ * streams the elements of a coroutine into a query without buffering them,
+ * the coroutine is suspended while the query has not asked for the next element
+ */
+template <class T>
+linq_collection<reader_iterator<generator<T>>> from_generator(generator<T>&& source)
+{
+    using iter_type = reader_iterator<generator<T>>;
+    return {iter_type(std::make_shared<generator<T>>(std::move(source))), iter_type()};
+}
+#endif
+
+/*
+ * rows of a delimited file, parsed while the query runs.
+ * Only the mapped columns are converted, rows are single pass and reused, copy a row to keep it
+ */
+template <class TRow, class... TFields>
+linq_collection<reader_iterator<csv_reader<TRow, TFields...>>> from_csv(const std::string& path, const csv_format& format, const csv_field<TRow, TFields>&... fields)
+{
+    using iter_type = reader_iterator<csv_reader<TRow, TFields...>>;
+    return {iter_type(std::make_shared<csv_reader<TRow, TFields...>>(path, format, fields...)), iter_type()};
+}
+
+template <class TRow, class... TFields>
+linq_collection<reader_iterator<csv_reader<TRow, TFields...>>> from_csv(const std::string& path, const csv_field<TRow, TFields>&... fields)
+{
+    return from_csv<TRow>(path, csv_format(), fields...);
+}
+
+#if defined(PL_LINQ_MMAP_WIN32) || defined(PL_LINQ_MMAP_POSIX)
+/*
+ * the records of a file of trivially copyable T, mapped read-only instead of loaded.
+ * The mapping stays alive as long as any query over it, the file must not be changed meanwhile
+ */
+template <class T>
+linq_collection<boxed_container_iterator<mapped_records<T>>> from_mmap(const std::string& path, mmap_access access = mmap_access::sequential)
+{
+    return from_shared(std::make_shared<mapped_records<T>>(path, access));
+}
+#endif
+}
+}
+
+#if defined(__cpp_lib_ranges)
+namespace std
+{
+//filtering stages inherit operator- from their source, it only measures the distance for random access iterators
+template <class TIterator>
+    requires pl::linq::is_linq_iterator<TIterator>::value && (!pl::linq::is_random_access<TIterator>::value)
+inline constexpr bool disable_sized_sentinel_for<TIterator, TIterator> = true;
+
+namespace ranges
+{
+//the iterators own the state of the query, they stay valid after the collection object is gone
+template <class TIterator>
+inline constexpr bool enable_borrowed_range<pl::linq::linq_collection<TIterator>> = true;
+
+template <class T>
+inline constexpr bool enable_borrowed_range<pl::linq::linq<T>> = true;
+
+template <class TIterator, class TKeySelectors>
+inline constexpr bool enable_borrowed_range<pl::linq::ordered_linq_collection<TIterator, TKeySelectors>> = true;
+}
+}
+#endif
+
+//counts heap allocations for instrumented stages, define PL_LINQ_INSTRUMENT_NEW in exactly one translation unit
+#if defined(PL_LINQ_INSTRUMENT) && defined(PL_LINQ_INSTRUMENT_NEW)
+#include <cstdlib>
+
+//gcc 11 and later cannot tell that these replace the global allocation functions
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+    ++pl::linq::thread_allocations();
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++pl::linq::thread_allocations();
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
 }
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
 }
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+#endif
@@ -6,6 +6,11 @@
 #include <assert.h>
 #include "linq.h"
 #include <iostream>
+#include <limits>
+#include <cmath>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
 
 using namespace std;
 using namespace pl::linq;
@@ -26,6 +31,128 @@ struct pet
     person owner;
 };
 
+struct copy_counter
+{
+    static int copies;
+    int value;
+
+    copy_counter(int v)
+        : value(v)
+    {
+    }
+
+    copy_counter(const copy_counter& other)
+        : value(other.value)
+    {
+        copies++;
+    }
+};
+
+int copy_counter::copies = 0;
+
+struct reading
+{
+    int sensor;
+    double value;
+};
+
+struct trade
+{
+    string symbol;
+    int quantity;
+    double price;
+    bool settled;
+};
+
+struct tracked_predicate
+{
+    static int copies;
+    static int moves;
+    vector<int> allowed;
+
+    explicit tracked_predicate(vector<int> values)
+        : allowed(move(values))
+    {
+    }
+
+    tracked_predicate(const tracked_predicate& other)
+        : allowed(other.allowed)
+    {
+        copies++;
+    }
+
+    tracked_predicate(tracked_predicate&& other)
+        : allowed(move(other.allowed))
+    {
+        moves++;
+    }
+
+    bool operator()(int x) const
+    {
+        return find(allowed.begin(), allowed.end(), x) != allowed.end();
+    }
+};
+
+int tracked_predicate::copies = 0;
+int tracked_predicate::moves = 0;
+
+class counting_resource : public memory_resource
+{
+public:
+    int allocations = 0;
+    int live = 0;
+
+private:
+    void* do_allocate(size_t bytes, size_t) override
+    {
+        allocations++;
+        live++;
+        return ::operator new(bytes);
+    }
+
+    void do_deallocate(void* p, size_t, size_t) override
+    {
+        live--;
+        ::operator delete(p);
+    }
+
+    bool do_is_equal(const memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+#ifdef PL_LINQ_HAS_COROUTINES
+generator<int> naturals(int* resumes)
+{
+    for (int i = 0;; i++)
+    {
+        ++*resumes;
+        co_yield i;
+    }
+}
+
+generator<string> pages(int count, int fail_at)
+{
+    for (int page = 0; page < count; page++)
+    {
+        if (page == fail_at)
+        {
+            throw std::runtime_error("cursor lost");
+        }
+        co_yield "page " + std::to_string(page);
+    }
+}
+
+generator<int> countdown(int from)
+{
+    while (from > 0)
+    {
+        co_yield from--;
+    }
+}
+#endif
+
 
 int main()
 {
@@ -91,11 +218,11 @@ int main()
 
         // print people and their animals in to levels
         /* prints
+        Hedlund, Magnus
+        Daisy
         Adams, Terry
         Barley
         Boots
-        Hedlund, Magnus
-        Daisy
         Weiss, Charlotte
         Whiskers
         */
@@ -110,9 +237,9 @@ int main()
         }
         // print people and their animals
         /* prints
+        Hedlund, Magnus: Daisy
         Adams, Terry: Barley
         Adams, Terry: Boots
-        Hedlund, Magnus: Daisy
         Weiss, Charlotte: Whiskers
         */
         for (auto x : from(persons).join(from(pets), person_name, pet_owner_name))
@@ -180,6 +307,47 @@ int test()
                 return x * 2;
             });
         assert(hidden.sequence_equal({2, 4, 6, 8, 10}));
+
+        auto it1 = hidden.begin();
+        auto it2 = it1;
+        ++it1;
+        assert(*it1 == 4 && *it2 == 2);
+
+        linq<int> copied = hidden;
+        assert(copied.sequence_equal(hidden));
+        assert(linq<int>().empty());
+    }
+    {
+        vector<int> xs;
+        for (int i = 1; i <= 1000; i++)
+        {
+            xs.push_back(i);
+        }
+        linq<int> hidden = from(xs);
+        assert(hidden.count() == 1000);
+        assert(hidden.sum() == 500500);
+        assert(hidden.contains(999));
+        assert(hidden.to_vector() == xs);
+
+        linq<string> names = from(xs).select([](int x) { return to_string(x); });
+        assert(names.count() == 1000);
+        assert(names.contains("1000"));
+        assert(!names.contains("0"));
+
+        // computed values are pulled a batch at a time as well
+        size_t calls = 0, seen = 0;
+        linq<int> doubled = from(xs).select([&calls](int x) { ++calls; return x * 2; });
+        assert(doubled.count() == 1000 && calls == 1000);
+        calls = 0;
+        assert(doubled.aggregate(0, [&calls, &seen](int acc, int x)
+            {
+                if (!seen)
+                {
+                    seen = calls;
+                }
+                return acc + x;
+            }) == 1001000);
+        assert(seen == any_iterator<int>::batch_size);
     }
     //////////////////////////////////////////////////////////////////
     // where
@@ -189,6 +357,24 @@ int test()
         assert(from(xs).where([](int x) { return x % 2 == 0; }).sequence_equal({2, 4}));
     }
     //////////////////////////////////////////////////////////////////
+    // chained terminals
+    //////////////////////////////////////////////////////////////////
+    {
+        int xs[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+        auto odd = [](int x) { return x % 2 == 1; };
+        auto square = [](int x) { return x * x; };
+        assert(from(xs).where(odd).select(square).sum() == 165);
+        assert(from(xs).where(odd).select(square).count() == 5);
+        assert(from(xs).where(odd).select(square).contains(81));
+        assert(!from(xs).where(odd).select(square).contains(4));
+        assert(from(xs).take(4).where(odd).select(square).to_vector() == vector<int>({1, 9}));
+        assert(from(xs).skip(8).where(odd).count() == 1);
+        assert(from(xs).take_while([](int x) { return x < 4; }).sum() == 6);
+        assert(from(xs).take_while([](int x) { return x < 20; }).count() == 10);
+        assert(from(xs).concat(from(xs).take(2)).select(square).sum() == 390);
+        assert(from(xs).zip_with(from(xs).skip(5)).count() == 5);
+    }
+    //////////////////////////////////////////////////////////////////
     // iterating
     //////////////////////////////////////////////////////////////////
     {
@@ -212,6 +398,493 @@ int test()
         assert(from(empty).concat(empty).sequence_equal(empty));
     }
     //////////////////////////////////////////////////////////////////
+    // references
+    //////////////////////////////////////////////////////////////////
+    {
+        vector<string> xs = {"a", "bb", "ccc", "dddd"};
+        auto longer = from(xs).where([](const string& x) { return x.size() > 1; });
+        static_assert(is_same<decltype(*longer.begin()), const string&>::value, "where should forward references");
+        static_assert(is_same<decltype(*longer.skip(1).take(1).begin()), const string&>::value, "skip and take should forward references");
+        static_assert(is_same<decltype(*longer.concat(xs).begin()), const string&>::value, "concat should forward references");
+        auto identity = [](const string& x) -> const string& { return x; };
+        static_assert(is_same<decltype(*longer.select(identity).begin()), string>::value, "select should yield values");
+        assert(&*longer.begin() == &xs[1]);
+        assert(&*longer.skip(1).begin() == &xs[2]);
+        assert(&*from(xs).take(1).concat(longer).begin() == &xs[0]);
+
+        vector<copy_counter> ys = {1, 2, 3, 4, 5};
+        copy_counter::copies = 0;
+        auto big = from(ys).where([](const copy_counter& x) { return x.value > 2; }).skip(1).take(2);
+        assert(big.aggregate(0, [](int a, const copy_counter& x) { return a + x.value; }) == 9);
+        assert(big.count() == 2);
+        for (const auto& y : big)
+        {
+            assert(y.value > 3);
+        }
+        assert(copy_counter::copies == 0);
+    }
+    //////////////////////////////////////////////////////////////////
+    // random access
+    //////////////////////////////////////////////////////////////////
+    {
+        vector<int> xs = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+        int ys[] = {10, 20, 30};
+        int calls = 0;
+        auto counted = from(xs).select([&calls](int x)
+            {
+                calls++;
+                return x;
+            });
+        using counted_iterator = decltype(counted.skip(1).take(5).begin());
+        static_assert(is_same<iterator_traits<counted_iterator>::iterator_category, random_access_iterator_tag>::value, "select, skip and take should keep random access");
+        auto filtered = from(xs).where([](int) { return true; });
+        using filtered_iterator = decltype(filtered.begin());
+        static_assert(is_same<iterator_traits<filtered_iterator>::iterator_category, forward_iterator_tag>::value, "where should be a forward iterator");
+
+        assert(counted.count() == 10 && calls == 0);
+        assert(counted.element_at(7) == 8 && calls == 1);
+        assert(counted.last() == 10 && calls == 2);
+        assert(counted.skip(3).first() == 4 && calls == 3);
+        assert(counted.skip(2).take(5).count() == 5 && calls == 3);
+        assert(counted.skip(2).take(5).last() == 7 && calls == 4);
+        assert(counted.skip(8).take(5).sequence_equal({9, 10}));
+        assert(counted.skip(20).take(5).count() == 0);
+        assert(counted.take(20).count() == 10);
+
+        auto both = from(ys).concat(xs);
+        assert(both.count() == 13);
+        assert(both.element_at(2) == 30);
+        assert(both.element_at(3) == 1);
+        assert(both.last() == 10);
+        auto it = both.begin();
+        it += 5;
+        assert(*it == 3);
+        it -= 3;
+        assert(*it == 30);
+        assert(both.end() - it == 11);
+
+        auto zipped = from(xs).zip_with(ys);
+        assert(zipped.count() == 3);
+        assert(zipped.last() == make_pair(3, 30));
+        assert(from(xs).where([](int x) { return x > 5; }).zip_with(ys).count() == 3);
+        assert(from(ys).zip_with(from(xs).where([](int x) { return x > 5; })).sequence_equal({make_pair(10, 6), make_pair(20, 7), make_pair(30, 8)}));
+    }
+    //////////////////////////////////////////////////////////////////
+    // rewriting
+    //////////////////////////////////////////////////////////////////
+    {
+        vector<int> xs = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+        list<int> ys = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+        auto even = [](int x) { return x % 2 == 0; };
+        auto large = [](int x) { return x > 4; };
+        auto fused = from(ys).where(even).where(large);
+        static_assert(is_same<decltype(fused.begin().source()), const list<int>::const_iterator&>::value, "adjacent where should be fused");
+        assert(fused.sequence_equal({6, 8, 10}));
+        assert(from(ys).where(even).where(large).where([](int x) { return x < 10; }).sequence_equal({6, 8}));
+
+        auto twice = from(ys).select([](int x) { return x * 2; }).select([](int x) { return to_string(x); });
+        static_assert(is_same<decltype(twice.begin().source()), const list<int>::const_iterator&>::value, "adjacent select should be fused");
+        assert(twice.first() == "2");
+        assert(twice.last() == "20");
+        auto names = from(ys).select([](int x) { return make_pair(x, to_string(x)); }).select([](const pair<int, string>& p) -> const string& { return p.second; });
+        assert(names.sequence_equal({"1", "2", "3", "4", "5", "6", "7", "8", "9", "10"}));
+
+        int calls = 0;
+        auto counted = from(ys).select([&calls](int x)
+            {
+                calls++;
+                return x;
+            });
+        assert(counted.count() == 10 && calls == 0);
+        assert(counted.select([](int x) { return x + 1; }).count() == 10 && calls == 0);
+        assert(counted.any() && calls == 0);
+        assert(!counted.where([](int) { return false; }).any() && calls == 10);
+
+        calls = 0;
+        assert(!counted.all([](int x) { return x < 3; }) && calls == 3);
+        assert(counted.all([](int x) { return x > 0; }) && calls == 13);
+        assert(from(vector<int>()).all([](int) { return false; }));
+
+        auto sliced = from(xs).skip(2).take(5);
+        static_assert(is_same<decltype(sliced.begin()), vector<int>::const_iterator>::value, "skip and take should slice random access sources");
+        assert(sliced.sequence_equal({3, 4, 5, 6, 7}));
+        assert(from(xs).skip(8).take(5).sequence_equal({9, 10}));
+        assert(from(xs).take(20).skip(9).sequence_equal({10}));
+        assert(from(xs).skip(20).empty());
+        assert(from(ys).skip(2).take(3).sequence_equal({3, 4, 5}));
+    }
+    //////////////////////////////////////////////////////////////////
+    // building
+    //////////////////////////////////////////////////////////////////
+    {
+        vector<int> xs = {1, 2, 3, 4, 5, 6};
+        auto square = [](int x) { return x * x; };
+        tracked_predicate::copies = 0;
+        tracked_predicate::moves = 0;
+        auto q = from(xs).where(tracked_predicate({2, 4, 5})).select(square).take_while([](int x) { return x < 20; });
+        auto copy = q;
+        assert(q.sequence_equal({4, 16}) && copy.to_vector() == q.to_vector());
+        assert(tracked_predicate::copies == 0 && tracked_predicate::moves == 1);
+
+        tracked_predicate odd({1, 3, 5});
+        auto source = from(xs);
+        auto skipped = source.skip_while(odd).select_many([](int x) { return vector<int>(x % 3, x); });
+        assert(skipped.sequence_equal({2, 2, 4, 5, 5}));
+        assert(tracked_predicate::copies == 1 && tracked_predicate::moves == 1);
+    }
+    //////////////////////////////////////////////////////////////////
+    // sentinels
+    //////////////////////////////////////////////////////////////////
+    {
+        vector<int> xs = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+        list<int> ys(xs.begin(), xs.end());
+        auto small = [](int x) { return x < 9; };
+        auto one = from(ys).take_while(small);
+        auto two = one.take_while(small);
+        auto three = two.take_while(small);
+        assert(sizeof(three.begin()) - sizeof(two.begin()) == sizeof(two.begin()) - sizeof(one.begin()));
+        assert(three.where([](int x) { return x > 3; }).take(3).sequence_equal({4, 5, 6}));
+
+        auto all = from(ys);
+        auto joined1 = all.concat(all);
+        auto joined2 = joined1.concat(all);
+        auto joined3 = joined2.concat(all);
+        assert(sizeof(joined3.begin()) - sizeof(joined2.begin()) == sizeof(joined2.begin()) - sizeof(joined1.begin()));
+        assert(joined3.count() == 40 && joined3.where([](int x) { return x == 10; }).count() == 4);
+        vector<int> backwards;
+        for (auto back = joined2.end(); back != joined2.begin();)
+        {
+            backwards.push_back(*--back);
+        }
+        auto reversed = joined2.to_vector();
+        std::reverse(reversed.begin(), reversed.end());
+        assert(backwards == reversed);
+        auto forward = from(ys).take_while(small);
+        assert(forward.concat(forward).concat(forward).select([](int x) { return x * 2; }).sum() == 216);
+        auto indexed = from(xs).concat(from(xs)).concat(from(xs));
+        auto eleventh_last = indexed.end();
+        eleventh_last -= 11;
+        assert(indexed.element_at(25) == 6 && indexed.end() - indexed.begin() == 30 && *eleventh_last == 10);
+        assert(from(ys).take(0).empty() && from(ys).skip(20).take(2).empty());
+        assert(from(ys).select_many([](int x) { return vector<int>(x % 3, x); }).take(4).sequence_equal({1, 2, 2, 4}));
+
+        auto prefix = from(ys).take_while([](int x) { return x < 4; });
+        auto it = prefix.begin();
+        it++;
+        ++it;
+        assert(*it == 3 && ++it == prefix.end());
+        auto taken = from(ys).take(2);
+        auto last = taken.begin();
+        assert(++last != taken.end() && ++last == taken.end());
+    }
+#if defined(__cpp_lib_ranges)
+    {
+        vector<int> xs = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+        list<int> ys(xs.begin(), xs.end());
+        auto q = from(xs).where([](int x) { return x % 2 == 0; }).select([](int x) { return x * 10; });
+        static_assert(std::ranges::forward_range<decltype(q)>, "linq collections should be ranges");
+        static_assert(std::ranges::bidirectional_range<decltype(from(ys).select([](int x) { return x; }))>, "select should keep the category");
+        static_assert(std::ranges::random_access_range<linq_collection<vector<int>::const_iterator>>, "sources should keep the category");
+        static_assert(std::ranges::borrowed_range<decltype(q)>, "linq iterators own the query state");
+        assert(std::ranges::distance(q) == 5);
+        assert(std::ranges::equal(q | std::views::take(2), vector<int>{20, 40}));
+        assert(std::ranges::equal(from(ys).skip(7) | std::views::reverse, vector<int>{10, 9, 8}));
+        assert(*std::ranges::find(from(xs).skip_while([](int x) { return x < 5; }), 7) == 7);
+    }
+#endif
+    //////////////////////////////////////////////////////////////////
+    // lines
+    //////////////////////////////////////////////////////////////////
+    {
+        auto to_string = [](line_view line) { return string(line); };
+        istringstream text("first\r\nsecond line\n\nERROR a line longer than the block\nlast");
+        auto lines = from_lines(text, 4).select(to_string).to_vector();
+        assert(lines == vector<string>({"first", "second line", "", "ERROR a line longer than the block", "last"}));
+
+        istringstream log("INFO a\nERROR b\nINFO c\nERROR d\n");
+        auto is_error = [](line_view line) { return line.size() > 5 && line[0] == 'E'; };
+        assert(from_lines(log, 8).where(is_error).select(to_string).to_vector() == vector<string>({"ERROR b", "ERROR d"}));
+        istringstream sizes("a\nbb\nccc\n");
+        assert(from_lines(sizes).aggregate(size_t(0), [](size_t a, line_view line) { return a + line.size(); }) == 6);
+        istringstream empty;
+        assert(from_lines(empty).empty());
+
+        // an erased line source must not read ahead of the element the query is looking at
+        string many;
+        vector<string> expected;
+        for (int i = 0; i < 20000; i++)
+        {
+            expected.push_back("line" + std::to_string(i));
+            many += expected.back() + "\n";
+        }
+        istringstream first_pass(many);
+        linq<line_view> erased = from_lines(first_pass, 64);
+        assert(erased.select(to_string).to_vector() == expected);
+        istringstream second_pass(many);
+        linq<line_view> searched = from_lines(second_pass, 64);
+        assert(searched.contains(line_view("line19999")));
+
+        {
+            ofstream out("mqLinq_lines.tmp", ios::binary);
+            out << "x\ny\nz";
+        }
+        assert(from_file_lines("mqLinq_lines.tmp", 2).skip(1).select(to_string).to_vector() == vector<string>({"y", "z"}));
+        remove("mqLinq_lines.tmp");
+        try
+        {
+            from_file_lines("mqLinq_missing.tmp");
+            assert(false);
+        }
+        catch (const file_not_readable&)
+        {
+        }
+    }
+    //////////////////////////////////////////////////////////////////
+    // mapped files
+    //////////////////////////////////////////////////////////////////
+    {
+        vector<reading> samples;
+        for (int i = 0; i < 1000; i++)
+        {
+            samples.push_back(reading{i % 4, i * 0.5});
+        }
+        vector<int> ids = {3, 1, 4, 1, 5, 9, 2, 6};
+        {
+            ofstream out("mqLinq_samples.tmp", ios::binary);
+            out.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(reading));
+            ofstream ints("mqLinq_ints.tmp", ios::binary);
+            ints.write(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(int));
+            ofstream odd("mqLinq_odd.tmp", ios::binary);
+            odd << "abc";
+            ofstream empty("mqLinq_empty.tmp", ios::binary);
+        }
+        {
+            auto mapped = from_mmap<reading>("mqLinq_samples.tmp");
+            static_assert(is_random_access<decltype(mapped.begin())>::value, "mapped records should be random access");
+            assert(mapped.count() == 1000);
+            assert(mapped.element_at(999).value == 499.5 && mapped.last().sensor == 3);
+            assert(mapped.where([](const reading& x) { return x.sensor == 2; }).count() == 250);
+            assert(from_mmap<reading>("mqLinq_samples.tmp", mmap_access::random).skip(10).take(3).select([](const reading& x) { return x.sensor; }).sequence_equal({2, 3, 0}));
+            assert(from_mmap<int>("mqLinq_ints.tmp").sum() == 31 && from_mmap<int>("mqLinq_ints.tmp").max() == 9);
+            assert(from_mmap<int>("mqLinq_empty.tmp").empty());
+        }
+        try
+        {
+            from_mmap<int>("mqLinq_odd.tmp");
+            assert(false);
+        }
+        catch (const file_not_readable&)
+        {
+        }
+        try
+        {
+            from_mmap<int>("mqLinq_missing.tmp");
+            assert(false);
+        }
+        catch (const file_not_readable&)
+        {
+        }
+        remove("mqLinq_samples.tmp");
+        remove("mqLinq_ints.tmp");
+        remove("mqLinq_odd.tmp");
+        remove("mqLinq_empty.tmp");
+    }
+    //////////////////////////////////////////////////////////////////
+    // csv
+    //////////////////////////////////////////////////////////////////
+    {
+        {
+            ofstream out("mqLinq_trades.tmp", ios::binary);
+            out << "id,symbol,quantity,price,settled,note\r\n"
+                << "1,ABC,10,1.5,true,plain\r\n"
+                << "2,\"X,Y\",-4,2.25,0,\"said \"\"hi\"\"\nand left\"\r\n"
+                << "\r\n"
+                << "3,\"ABC\",,100,1,\n"
+                << "4,\"a \"\"quoted\"\" name\",7,0.5,false";
+        }
+        auto fields = [](const csv_format& format)
+        {
+            return from_csv<trade>("mqLinq_trades.tmp", format,
+                                   csv_column("symbol", &trade::symbol),
+                                   csv_column(2, &trade::quantity),
+                                   csv_column("price", &trade::price),
+                                   csv_column("settled", &trade::settled));
+        };
+        auto to_symbol = [](const trade& t) { return t.symbol; };
+        for (size_t block : {size_t(3), size_t(7), size_t(64 * 1024)})
+        {
+            csv_format format;
+            format.block_size = block;
+            assert(fields(format).select(to_symbol).to_vector() == vector<string>({"ABC", "X,Y", "ABC", "a \"quoted\" name"}));
+            assert(fields(format).select([](const trade& t) { return t.quantity; }).sequence_equal({10, -4, 0, 7}));
+            assert(fields(format).where([](const trade& t) { return t.settled; }).count() == 2);
+            assert(fields(format).select([](const trade& t) { return t.price; }).sum() == 104.25);
+        }
+        auto groups = fields(csv_format()).group_by([](const trade& t) { return t.symbol; }).to_vector();
+        assert(groups.size() == 3 && groups[0].first == "ABC" && groups[0].second.count() == 2);
+
+        {
+            ofstream out("mqLinq_plain.tmp", ios::binary);
+            out << "1;2;3\n4;5;6\n";
+        }
+        csv_format plain;
+        plain.delimiter = ';';
+        plain.header = false;
+        assert(from_csv<trade>("mqLinq_plain.tmp", plain, csv_column(1, &trade::quantity)).select([](const trade& t) { return t.quantity; }).sequence_equal({2, 5}));
+        assert(from_csv<trade>("mqLinq_trades.tmp", csv_column(0, &trade::quantity)).select([](const trade& t) { return t.quantity; }).sequence_equal({1, 2, 3, 4}));
+
+        auto throws_format_error = [](const function<void()>& f)
+        {
+            try
+            {
+                f();
+                return false;
+            }
+            catch (const csv_format_error&)
+            {
+                return true;
+            }
+        };
+        assert(throws_format_error([] { from_csv<trade>("mqLinq_trades.tmp", csv_column("missing", &trade::price)).count(); }));
+        assert(throws_format_error([] { from_csv<trade>("mqLinq_trades.tmp", csv_column(0, &trade::price), csv_column("id", &trade::price)).count(); }));
+        assert(throws_format_error([] { from_csv<trade>("mqLinq_trades.tmp", csv_column(1, &trade::quantity)).count(); }));
+        assert(throws_format_error([&plain] { from_csv<trade>("mqLinq_plain.tmp", plain, csv_column("a", &trade::quantity)); }));
+        {
+            ofstream out("mqLinq_plain.tmp", ios::binary);
+            out << "9999999999\n";
+        }
+        assert(throws_format_error([&plain] { from_csv<trade>("mqLinq_plain.tmp", plain, csv_column(0, &trade::quantity)).count(); }));
+        {
+            ofstream out("mqLinq_plain.tmp", ios::binary);
+            out << "1;2\n3\n";
+        }
+        assert(throws_format_error([&plain] { from_csv<trade>("mqLinq_plain.tmp", plain, csv_column(1, &trade::quantity)).count(); }));
+        {
+            ofstream out("mqLinq_plain.tmp", ios::binary);
+            out << "a\n\r\n\nb\n";
+        }
+        // a blank line is a record with one empty field
+        assert(from_csv<trade>("mqLinq_plain.tmp", plain, csv_column(0, &trade::symbol)).select(to_symbol).to_vector() == vector<string>({"a", "", "", "b"}));
+        {
+            ofstream out("mqLinq_plain.tmp", ios::binary);
+            out << "a,b\n1,2\n\r\n3,4\n\n";
+        }
+        // in files with more columns it only separates records
+        auto pairs = from_csv<trade>("mqLinq_plain.tmp", csv_column(0, &trade::quantity), csv_column("b", &trade::price));
+        assert(pairs.select([](const trade& t) { return t.quantity * 10 + t.price; }).sequence_equal({12.0, 34.0}));
+        remove("mqLinq_trades.tmp");
+        remove("mqLinq_plain.tmp");
+        try
+        {
+            from_csv<trade>("mqLinq_missing.tmp", csv_column(0, &trade::quantity));
+            assert(false);
+        }
+        catch (const file_not_readable&)
+        {
+        }
+    }
+#ifdef PL_LINQ_HAS_COROUTINES
+    //////////////////////////////////////////////////////////////////
+    // generators
+    //////////////////////////////////////////////////////////////////
+    {
+        int resumes = 0;
+        auto numbers = from_generator(naturals(&resumes));
+        assert(resumes == 0);
+        auto odd_squares = std::move(numbers)
+            .where([](int x) { return x % 2 == 1; })
+            .select([](int x) { return x * x; })
+            .take(4);
+        assert(odd_squares.sequence_equal({1, 9, 25, 49}));
+        assert(resumes == 8);
+
+        assert(from_generator(pages(3, -1)).to_vector() == vector<string>({"page 0", "page 1", "page 2"}));
+        assert(from_generator(pages(0, -1)).empty());
+        try
+        {
+            from_generator(pages(5, 2)).count();
+            assert(false);
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+
+        counting_resource resource;
+        {
+            memory_scope scope(resource);
+            auto q = from_generator(pages(2, -1));
+            assert(resource.allocations == 1 && resource.live == 1);
+            assert(q.last() == "page 1");
+        }
+        assert(resource.live == 0);
+
+        counting_resource frames;
+        {
+            auto left = with_memory(frames, [] { return from_generator(countdown(4)); });
+            assert(frames.allocations == 1 && left.sum() == 10);
+        }
+        assert(frames.live == 0);
+    }
+#endif
+    //////////////////////////////////////////////////////////////////
+    // memory
+    //////////////////////////////////////////////////////////////////
+    {
+        vector<int> xs = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+        auto mod3 = [](int x) { return x % 3; };
+        counting_resource resource;
+        {
+            memory_scope scope(resource);
+            auto groups = from(xs).group_by(mod3);
+            auto halves = from(xs).select([](int x) { return x / 2; }).distinct();
+            auto joined = from(xs).full_join(xs, [](int x) { return x % 4; }, mod3);
+            auto common = from(xs).intersect_with({2, 4, 12});
+            auto values = from_values({3, 1, 2});
+            auto sorted = values.order_by([](int x) { return x; });
+            assert(groups.select([](const pair<int, linq<int>>& p) { return p.second.count(); }).sequence_equal(vector<size_t>{4, 3, 3}));
+            assert(halves.sequence_equal({0, 1, 2, 3, 4, 5}));
+            assert(joined.count() == 4);
+            assert(common.sequence_equal({2, 4}));
+            assert(sorted.sequence_equal({1, 2, 3}));
+            assert(resource.allocations > 0 && resource.live > 0);
+        }
+        assert(resource.live == 0);
+        int before = resource.allocations;
+        assert(from(xs).group_by(mod3).count() == 3 && resource.allocations == before);
+
+        query_arena arena(64);
+        auto sizes = with_memory(arena, [&xs, &mod3]()
+            {
+                return from(xs).group_by(mod3).select([](const pair<int, linq<int>>& p) { return p.second.count(); }).to_vector();
+            });
+        assert(sizes == vector<size_t>({4, 3, 3}));
+        assert(arena.used() > 0);
+        arena.release();
+        assert(arena.used() == 0);
+        void* small = arena.allocate(1, 1);
+        void* aligned = arena.allocate(8, 64);
+        void* large = arena.allocate(1000, 8);
+        assert(small && large && reinterpret_cast<uintptr_t>(aligned) % 64 == 0);
+        assert(arena.used() == 1009);
+    }
+    //////////////////////////////////////////////////////////////////
+    // explain
+    //////////////////////////////////////////////////////////////////
+    {
+        vector<int> xs = {1, 2, 3, 4, 5};
+        list<int> ys = {1, 2, 3};
+        auto odd = [](int x) { return x % 2 == 1; };
+        auto square = [](int x) { return x * x; };
+
+        assert(from(xs).where(odd).where(odd).select(square).explain() == "select\n  where\n    source (random access)\n");
+        assert(from(ys).skip(1).take_while(odd).explain() == "take_while\n  skip\n    source (bidirectional)\n");
+        assert(from(ys).concat(xs).distinct().explain() == "distinct\n  concat\n    source (bidirectional)\n    source (random access)\n");
+        assert(from(xs).join(ys, square, square).explain() == "join\n  source (random access)\n");
+        assert(from(xs).order_by(square).explain() == "order_by\n");
+        assert(linq<int>(from(xs)).explain() == "linq (type erased)\n");
+    }
+    //////////////////////////////////////////////////////////////////
     // counting
     //////////////////////////////////////////////////////////////////
     {
@@ -361,6 +1034,10 @@ int test()
         assert(from(xs).min() == 1);
         assert(from(xs).max() == 5);
         assert(from(xs).average<double>() == 3.0);
+        vector<int> negative = {-3, -6, -7};
+        list<int> negative_list(negative.begin(), negative.end());
+        assert(from(negative).average<int>() == -5 && from(negative_list).average<int>() == -5);
+        assert(from(negative_list).average<double>() == -16.0 / 3);
 
         vector<int> ys;
         try
@@ -395,6 +1072,51 @@ int test()
         catch (const linq_exception&)
         {
         }
+        try
+        {
+            from(list<int>()).average<double>();
+            assert(false);
+        }
+        catch (const linq_exception&)
+        {
+        }
+        try
+        {
+            from(ys).sum();
+            assert(false);
+        }
+        catch (const linq_exception&)
+        {
+        }
+
+        // contiguous arithmetic sources take the vectorized path, the results match the scalar ones
+        vector<int> ints(1003);
+        vector<long long> longs(1003);
+        vector<double> doubles(1003);
+        vector<float> floats(1003);
+        long long int_sum = 0;
+        for (int i = 0; i < 1003; i++)
+        {
+            ints[i] = (i * 7919) % 1000 - 500;
+            longs[i] = ints[i] * (1LL << 33);
+            doubles[i] = ints[i] * 0.5;
+            floats[i] = static_cast<float>(ints[i]);
+            int_sum += ints[i];
+        }
+        ints[977] = -100000;
+        longs[3] = std::numeric_limits<long long>::max();
+        int_sum -= (977 * 7919) % 1000 - 500 + 100000;
+        assert(from(ints).sum() == int_sum);
+        assert(from(ints).sum() == from(ints).select([](int x) { return x; }).sum());
+        assert(from(ints).min() == -100000);
+        assert(from(ints).max() == 499);
+        assert(from(longs).max() == std::numeric_limits<long long>::max());
+        assert(from(longs).min() == from(longs).select([](long long x) { return x; }).min());
+        assert(from(doubles).sum() == from(doubles).select([](double x) { return x; }).sum());
+        assert(from(doubles).average<double>() == from(doubles).sum() / 1003);
+        assert(from(floats).max() == 499.0f && from(floats).min() == -500.0f);
+        assert(std::abs(from(floats).sum() - from(floats).select([](float x) { return x; }).sum()) < 1.0f);
+        assert(from(ints.data(), ints.data() + 5).sum() == from(ints).take(5).sum());
     }
     //////////////////////////////////////////////////////////////////
     // set
@@ -407,6 +1129,73 @@ int test()
         assert(from(xs).except_with(ys).sequence_equal({1}));
         assert(from(xs).intersect_with(ys).sequence_equal({2, 3}));
         assert(from(xs).union_with(ys).sequence_equal({1, 2, 3, 4}));
+        assert(from(xs).union_with({5, 1, 6}).sequence_equal({1, 2, 3, 5, 6}));
+        // containers are copied too, the temporary is gone before enumeration
+        auto with_temp = from(xs).union_with(vector<int>{7, 1, 8});
+        assert(with_temp.sequence_equal({1, 2, 3, 7, 8}));
+        assert(from(xs).except_with({3}).sequence_equal({1, 2}));
+        assert(from(xs).intersect_with({3, 1, 7}).sequence_equal({1, 3}));
+
+        // distinct is lazy and every enumeration sees the same result
+        int largest = 0;
+        auto firsts = from_values({5, 3, 5, 1, 3, 2, 4, 4})
+            .select([&largest](int x)
+                {
+                    largest = std::max(largest, x == 5 ? 0 : x);
+                    return x;
+                })
+            .distinct();
+        assert(firsts.take(3).sequence_equal({5, 3, 1}));
+        assert(largest == 3);
+        assert(firsts.sequence_equal({5, 3, 1, 2, 4}));
+        assert(firsts.take(2).to_vector() == vector<int>({5, 3}));
+        assert(firsts.count() == 5);
+
+        // enumerations keep their own tables, so one query can be enumerated from several threads
+        vector<int> repeated;
+        for (int i = 0; i < 20000; i++)
+        {
+            repeated.push_back(i % 500);
+        }
+        auto unique = from(repeated).distinct();
+        auto it1 = unique.begin();
+        auto it2 = unique.begin();
+        ++it1;
+        ++it1;
+        ++it2;
+        assert(*it1 == 2 && *it2 == 1 && *++it2 == 2);
+        vector<size_t> counts(4);
+        vector<thread> readers;
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            readers.emplace_back([&unique, &counts, i]() { counts[i] = unique.count(); });
+        }
+        for (auto& reader : readers)
+        {
+            reader.join();
+        }
+        assert(counts == vector<size_t>(4, 500));
+
+        vector<string> words = {"apple", "Banana", "avocado", "cherry", "blueberry"};
+        assert(from(words).distinct_by([](const string& s) { return s[0] | 0x20; })
+            .sequence_equal({"apple", "Banana", "cherry"}));
+
+        auto lower_hash = [](const string& s)
+            {
+                string t = s;
+                std::transform(t.begin(), t.end(), t.begin(), ::tolower);
+                return std::hash<string>()(t);
+            };
+        auto lower_equal = [](const string& a, const string& b)
+            {
+                return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) { return ::tolower(x) == ::tolower(y); });
+            };
+        vector<string> names = {"Ann", "bob", "ANN", "Bob", "carl"};
+        vector<string> others = {"BOB", "dave"};
+        assert(from(names).distinct(lower_hash, lower_equal).sequence_equal({"Ann", "bob", "carl"}));
+        assert(from(names).except_with(others, lower_hash, lower_equal).sequence_equal({"Ann", "carl"}));
+        assert(from(names).intersect_with(others, lower_hash, lower_equal).sequence_equal({"bob"}));
+        assert(from(names).union_with(others, lower_hash, lower_equal).sequence_equal({"Ann", "bob", "carl", "dave"}));
     }
     //////////////////////////////////////////////////////////////////
     // restructuring
@@ -422,15 +1211,41 @@ int test()
             {
                 return x % 2;
             });
-        assert(g.select([](std::pair<int, linq<int>> p) { return p.first; }).sequence_equal({0, 1}));
-        assert(g.first().second.sequence_equal({2, 4}));
-        assert(g.last().second.sequence_equal({1, 3, 5}));
+        assert(g.select([](std::pair<int, linq<int>> p) { return p.first; }).sequence_equal({1, 0}));
+        assert(g.first().second.sequence_equal({1, 3, 5}));
+        assert(g.last().second.sequence_equal({2, 4}));
+
+        vector<pet> owned = {{"Barley", {"Terry"}}, {"Daisy", {"Magnus"}}, {"Boots", {"Terry"}}, {"Whiskers", {"Charlotte"}}};
+        auto owner_name = [](const pet& p) { return p.owner.name; };
+        auto per_owner = from(owned).count_by(owner_name).to_vector();
+        assert(per_owner == (vector<std::pair<string, std::size_t>>{{"Terry", 2}, {"Magnus", 1}, {"Charlotte", 1}}));
+        auto letters = from(owned).aggregate_by(owner_name, string(), [](string&& acc, const pet& p) { return acc + p.name[0]; });
+        assert(letters.last().second == "W" && letters.first().second == "BB");
+        auto parity_sums = from(xs).sum_by([](int x) { return x % 2; });
+        assert(parity_sums.sequence_equal({std::make_pair(1, 9), std::make_pair(0, 6)}));
+        auto lengths = from(owned).sum_by(owner_name, [](const pet& p) { return p.name.size(); });
+        assert(lengths.first().second == std::string("BarleyBoots").size());
 
         assert(
             from_values({1, 2, 3})
             .select_many([](int x) { return from_values({x, x*x, x*x*x}); })
             .sequence_equal({1, 1, 1, 2, 4, 8, 3, 9, 27})
         );
+
+        vector<vector<int>> nested = {{}, {1, 2}, {}, {}, {3}, {4, 5, 6}, {}};
+        auto flat = from(nested).select_many([](const vector<int>& x) { return from(x); });
+        assert(flat.sequence_equal({1, 2, 3, 4, 5, 6}));
+        assert(flat.count() == 6 && flat.sum() == 21);
+        auto it = flat.begin();
+        auto copy = it;
+        ++it;
+        assert(*copy == 1 && *it == 2);
+        assert(from_values({3, 0, 2}).select_many([](int x) { return vector<int>(x, x); }).sequence_equal({3, 3, 3, 2, 2}));
+        assert(from(nested).take(1).select_many([](const vector<int>& x) { return from(x); }).empty());
+
+        vector<int> many(5000, 1);
+        linq<int> expanded = from(many).select_many([](int x) { return from_values({x, x}); });
+        assert(expanded.count() == 10000);
     }
     //////////////////////////////////////////////////////////////////
     // ordering
@@ -441,6 +1256,56 @@ int test()
         int zs[] = {10, 1, 11, 2, 12, 3, 13, 4, 5, 6, 7, 8, 9};
 
         assert(from(xs).order_by([](int x) { return x; }).sequence_equal(ys));
+        assert(from(xs).order_by_descending([](int x) { return x; }).sequence_equal(from(ys).order_by([](int x) { return -x; })));
+        assert(from(xs).order_by([](int x) { return x % 10; }).then_by([](int x) { return x / 10; }).sequence_equal(zs));
+        assert(from(xs).order_by([](int x) { return x % 10; }).sequence_equal({10, 1, 11, 12, 2, 3, 13, 4, 5, 6, 7, 8, 9}));
+        assert(from(xs).order_by([](int x) { return x % 10; }).then_by_descending([](int x) { return x; }).sequence_equal({10, 11, 1, 12, 2, 13, 3, 4, 5, 6, 7, 8, 9}));
+        assert(from(xs).order_by_descending([](int x) { return x % 3; }).then_by([](int x) { return x; }).sequence_equal({2, 5, 8, 11, 1, 4, 7, 10, 13, 3, 6, 9, 12}));
+
+        int calls = 0;
+        auto sorted = from(xs).order_by([&calls](int x)
+            {
+                calls++;
+                return x;
+            });
+        assert(calls == 0);
+        assert(sorted.last() == 13 && sorted.count() == 13);
+        assert(sorted.element_at(4) == 5);
+        assert(calls == 13);
+        // first() selects the smallest element in its own pass instead of sorting
+        assert(sorted.first() == 1);
+        assert(calls == 26);
+
+        assert(from(xs).order_by([](int x) { return x % 10; }).take(4).sequence_equal({10, 1, 11, 12}));
+        assert(from(xs).order_by([](int x) { return x % 10; }).then_by_descending([](int x) { return x; }).take(3).sequence_equal({10, 11, 1}));
+        assert(from(xs).order_by([](int x) { return x; }).take(20).sequence_equal(ys));
+        assert(from(xs).order_by([](int x) { return x; }).take(0).empty());
+        assert(from(xs).order_by([](int x) { return x; }).take(5).take(2).sequence_equal({1, 2}));
+        assert(from(xs).top_k(3, [](int x) { return x; }).sequence_equal({13, 12, 11}));
+        assert(from(xs).bottom_k(3, [](int x) { return x % 5; }).sequence_equal({5, 10, 1}));
+        assert(from(xs).top_k(2, [](int x) { return x % 5; }).sequence_equal({4, 9}));
+        assert(from_values({3, 1, 2}).order_by([](int x) { return x; }).first() == 1);
+        assert(from(ys).take(0).order_by([](int x) { return x; }).first_or_default(-1) == -1);
+
+        std::list<string> words = {"pear", "fig", "banana", "kiwi", "apple", "plum"};
+        auto length = [](const string& w) { return w.size(); };
+        assert(from(words).min_by(length) == "fig");
+        assert(from(words).max_by(length) == "banana");
+        assert(from(words).max_by([](const string& w) { return w.size() % 5; }) == "pear");
+        assert(from(words).min_by([](const string& w) { return w.size() % 2; }) == "pear");
+        try
+        {
+            from(words).take(0).min_by(length);
+            assert(false);
+        }
+        catch (const collection_empty&)
+        {
+        }
+
+        person people[] = {{"b"}, {"a"}, {"c"}, {"a"}, {"b"}};
+        auto by_name = from(people).order_by([](const person& p) { return p.name; });
+        assert(by_name.select([](const person& p) { return p.name; }).sequence_equal({"a", "a", "b", "b", "c"}));
+        assert(&*by_name.begin() != &people[1]);
         assert(
             flatten(
                 from(xs)
@@ -482,39 +1347,200 @@ int test()
         {
             typedef std::tuple<string, linq<person>, linq<pet>> TItem;
             auto xs = f.to_vector();
-            assert(from(xs).select([](const TItem& item) { return std::get<0>(item); }).sequence_equal({terry.name, magnus.name, charlotte.name}));
-            assert(std::get<1>(xs[0]).select(person_name).sequence_equal({terry.name}));
-            assert(std::get<1>(xs[1]).select(person_name).sequence_equal({magnus.name}));
+            assert(from(xs).select([](const TItem& item) { return std::get<0>(item); }).sequence_equal({magnus.name, terry.name, charlotte.name}));
+            assert(std::get<1>(xs[0]).select(person_name).sequence_equal({magnus.name}));
+            assert(std::get<1>(xs[1]).select(person_name).sequence_equal({terry.name}));
             assert(std::get<1>(xs[2]).select(person_name).sequence_equal({charlotte.name}));
-            assert(std::get<2>(xs[0]).select(pet_name).sequence_equal({barley.name, boots.name}));
-            assert(std::get<2>(xs[1]).select(pet_name).sequence_equal({daisy.name}));
+            assert(std::get<2>(xs[0]).select(pet_name).sequence_equal({daisy.name}));
+            assert(std::get<2>(xs[1]).select(pet_name).sequence_equal({barley.name, boots.name}));
             assert(std::get<2>(xs[2]).select(pet_name).sequence_equal({whiskers.name}));
         }
         auto g = from(persons).group_join(from(pets), person_name, pet_owner_name);
         {
             typedef std::tuple<string, person, linq<pet>> TItem;
             auto xs = g.to_vector();
-            assert(from(xs).select([](const TItem& item) { return std::get<0>(item); }).sequence_equal({terry.name, magnus.name, charlotte.name}));
-            assert(std::get<1>(xs[0]).name == terry.name);
-            assert(std::get<1>(xs[1]).name == magnus.name);
+            assert(from(xs).select([](const TItem& item) { return std::get<0>(item); }).sequence_equal({magnus.name, terry.name, charlotte.name}));
+            assert(std::get<1>(xs[0]).name == magnus.name);
+            assert(std::get<1>(xs[1]).name == terry.name);
             assert(std::get<1>(xs[2]).name == charlotte.name);
-            assert(std::get<2>(xs[0]).select(pet_name).sequence_equal({barley.name, boots.name}));
-            assert(std::get<2>(xs[1]).select(pet_name).sequence_equal({daisy.name}));
+            assert(std::get<2>(xs[0]).select(pet_name).sequence_equal({daisy.name}));
+            assert(std::get<2>(xs[1]).select(pet_name).sequence_equal({barley.name, boots.name}));
             assert(std::get<2>(xs[2]).select(pet_name).sequence_equal({whiskers.name}));
         }
         auto j = from(persons).join(from(pets), person_name, pet_owner_name);
         {
             typedef std::tuple<string, person, pet> TItem;
             auto xs = j.to_vector();
-            assert(from(xs).select([](const TItem& item) { return std::get<0>(item); }).sequence_equal({terry.name, terry.name, magnus.name, charlotte.name}));
-            assert(std::get<1>(xs[0]).name == terry.name);
+            assert(from(xs).select([](const TItem& item) { return std::get<0>(item); }).sequence_equal({magnus.name, terry.name, terry.name, charlotte.name}));
+            assert(std::get<1>(xs[0]).name == magnus.name);
             assert(std::get<1>(xs[1]).name == terry.name);
-            assert(std::get<1>(xs[2]).name == magnus.name);
+            assert(std::get<1>(xs[2]).name == terry.name);
             assert(std::get<1>(xs[3]).name == charlotte.name);
-            assert(std::get<2>(xs[0]).name == barley.name);
-            assert(std::get<2>(xs[1]).name == boots.name);
-            assert(std::get<2>(xs[2]).name == daisy.name);
+            assert(std::get<2>(xs[0]).name == daisy.name);
+            assert(std::get<2>(xs[1]).name == barley.name);
+            assert(std::get<2>(xs[2]).name == boots.name);
             assert(std::get<2>(xs[3]).name == whiskers.name);
+            assert(j.count() == 4);
+        }
+        person arlene = {"Huff, Arlene"};
+        pet nemo = {"Nemo", {"Unknown"}};
+        person more_persons[] = {arlene};
+        pet more_pets[] = {nemo};
+        auto owners = from(persons).concat(more_persons);
+        auto all_pets = from(pets).concat(more_pets);
+        {
+            auto xs = owners.left_join(all_pets, person_name, pet_owner_name, pet{"(none)", {}}).to_vector();
+            assert(xs.size() == 5);
+            assert(std::get<0>(xs[4]) == arlene.name);
+            assert(std::get<2>(xs[4]).name == "(none)");
+            assert(owners.left_join(all_pets, person_name, pet_owner_name)
+                .select([](const std::tuple<string, person, pet>& item) { return std::get<2>(item).name; })
+                .sequence_equal({daisy.name, barley.name, boots.name, whiskers.name, string()}));
+        }
+        {
+            auto xs = owners.right_join(all_pets, person_name, pet_owner_name, person{"(nobody)"}).to_vector();
+            assert(xs.size() == 5);
+            assert(std::get<1>(xs[0]).name == terry.name);
+            assert(std::get<2>(xs[0]).name == barley.name);
+            assert(std::get<1>(xs[4]).name == "(nobody)");
+            assert(std::get<2>(xs[4]).name == nemo.name);
+        }
+        {
+            auto xs = owners.full_join(all_pets, person_name, pet_owner_name).to_vector();
+            assert(xs.size() == 5);
+            assert(std::get<0>(xs[3]) == arlene.name && std::get<2>(xs[3]).empty());
+            assert(std::get<0>(xs[4]) == "Unknown" && std::get<1>(xs[4]).empty());
+            auto ys = owners.group_join(all_pets, person_name, pet_owner_name).to_vector();
+            assert(std::get<2>(ys[3]).empty());
+        }
+    }
+    //////////////////////////////////////////////////////////////////
+    // parallel
+    //////////////////////////////////////////////////////////////////
+    {
+        vector<long long> xs(100000);
+        for (std::size_t i = 0; i < xs.size(); i++)
+        {
+            xs[i] = static_cast<long long>(i);
+        }
+        auto even = [](long long x) { return x % 2 == 0; };
+        auto twice = [](long long x) { return x * 2; };
+        auto q = from(xs).where(even).select(twice);
+
+        assert(from(xs).as_parallel().where(even).select(twice).sum() == q.sum());
+        assert(from(xs).as_parallel().where(even).select(twice).to_vector() == q.to_vector());
+        assert(from(xs).as_parallel().where(even).count() == 50000);
+        assert(from(xs).as_parallel().select(twice).max() == 199998);
+        assert(from(xs).as_parallel().where([](long long x) { return x > 10; }).min() == 11);
+        assert(from(xs).as_parallel().any([](long long x) { return x == 77777; }));
+        assert(!from(xs).as_parallel().any([](long long x) { return x < 0; }));
+        assert(from(xs).as_parallel().all([](long long x) { return x >= 0; }));
+        assert(!from(xs).as_parallel().where([](long long x) { return x < 0; }).any());
+
+        thread_pool pool(3);
+        assert(pool.concurrency() == 4);
+        auto unordered = from(xs).as_parallel(pool).as_unordered().where(even).to_vector();
+        std::sort(unordered.begin(), unordered.end());
+        assert(unordered == from(xs).where(even).to_vector());
+        auto digits = from(xs).as_parallel(pool).select([](long long x) { return static_cast<int>(x % 10); })
+            .aggregate(std::size_t(0), [](std::size_t n, int d) { return n + (d == 7); }, std::plus<std::size_t>());
+        assert(digits == 10000);
+        auto text = from_values({1, 2, 3, 4, 5, 6, 7, 8, 9}).as_parallel(pool)
+            .select([](int x) { return std::to_string(x); })
+            .aggregate([](const string& a, const string& b) { return a + b; });
+        assert(text == "123456789");
+
+        std::list<int> linked = {3, 1, 4, 1, 5};
+        assert(from(linked).as_parallel(pool).sum() == 14);
+        assert(from(linked).as_parallel(pool).to_vector() == vector<int>({3, 1, 4, 1, 5}));
+
+        // skewed work: one outer element fans out to most of the rows
+        auto fan_out = from_values({1, 2, 200000, 3, 4, 5, 6, 7}).as_parallel(pool)
+            .select_many([](int n) { return from_values(vector<int>(n, 1)); });
+        assert(fan_out.count() == 200028);
+        assert(fan_out.sum() == 200028);
+        assert(fan_out.to_vector().size() == 200028);
+
+        auto groups = from(xs).group_by([](long long x) { return x % 7; });
+        auto group_sums = groups.as_parallel(pool).with_grain(1)
+            .select([](const std::pair<long long, linq<long long>>& g) { return g.second.sum(); })
+            .to_vector();
+        assert(group_sums == groups.select([](const std::pair<long long, linq<long long>>& g) { return g.second.sum(); }).to_vector());
+
+        // nested queries run on the same pool without blocking it
+        auto nested = from_values({1, 2, 3, 4}).as_parallel(pool)
+            .select([&pool, &xs](int k) { return from(xs).as_parallel(pool).where([k](long long x) { return x % k == 0; }).count(); })
+            .to_vector();
+        assert(nested == vector<std::size_t>({100000, 50000, 33334, 25000}));
+
+        thread_pool lonely(0);
+        assert(from(xs).as_parallel(lonely).where(even).sum() == from(xs).where(even).sum());
+
+        vector<int> none;
+        assert(from(none).as_parallel(pool).count() == 0);
+        assert(from(none).as_parallel(pool).to_vector().empty());
+        try
+        {
+            from(none).as_parallel(pool).sum();
+            assert(false);
+        }
+        catch (const collection_empty&)
+        {
+        }
+        try
+        {
+            from(xs).as_parallel(pool).select([](long long x)
+                {
+                    if (x == 4242)
+                    {
+                        throw std::runtime_error("bad element");
+                    }
+                    return x;
+                }).sum();
+            assert(false);
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+
+        // files are split by byte ranges, a line belongs to the range it starts in
+        {
+            ofstream out("mqLinq_log.tmp", ios::binary);
+            for (int i = 0; i < 2000; i++)
+            {
+                out << (i % 3 == 0 ? "ERROR " : "INFO ") << string(static_cast<size_t>(i % 17), 'x') << i << (i % 5 == 0 ? "\r\n" : "\n");
+            }
+            out << "\nlast";
+        }
+        auto to_string = [](line_view line) { return string(line.data(), line.size()); };
+        auto level = [](const string& line) { return line.substr(0, line.find(' ')); };
+        auto lines = from_file_lines("mqLinq_log.tmp").select(to_string).to_vector();
+        auto is_error = [](line_view line) { return line.size() >= 5 && std::equal(line.data(), line.data() + 5, "ERROR"); };
+        for (size_t grain : {size_t(0), size_t(1), size_t(7), size_t(100), size_t(1 << 20)})
+        {
+            auto scan = from_file_lines_parallel("mqLinq_log.tmp", pool, 16).with_grain(grain);
+            assert(scan.count() == lines.size());
+            assert(scan.where(is_error).count() == 667);
+            assert(scan.select(to_string).to_vector() == lines);
+            assert(scan.select([](line_view line) { return line.size(); }).sum() == from(lines).select([](const string& line) { return line.size(); }).sum());
+            auto levels = scan.select(to_string).group_by(level).select([](const pair<string, linq<string>>& g) { return make_pair(g.first, g.second.count()); }).to_vector();
+            assert((levels == vector<pair<string, size_t>>({{"ERROR", 667}, {"INFO", 1333}, {"", 1}, {"last", 1}})));
+        }
+        auto grouped = from_file_lines_parallel("mqLinq_log.tmp", lonely).as_unordered().select(to_string).group_by(level);
+        assert(grouped.count() == 4 && grouped.select([](const pair<string, linq<string>>& g) { return g.second.count(); }).sum() == lines.size());
+        {
+            ofstream empty("mqLinq_log.tmp", ios::binary);
+        }
+        assert(from_file_lines_parallel("mqLinq_log.tmp", pool).count() == 0);
+        assert(from_file_lines_parallel("mqLinq_log.tmp", pool).select(to_string).group_by(level).empty());
+        remove("mqLinq_log.tmp");
+        try
+        {
+            from_file_lines_parallel("mqLinq_missing.tmp", pool);
+            assert(false);
+        }
+        catch (const file_not_readable&)
+        {
         }
     }
 #ifdef _MSC_VER
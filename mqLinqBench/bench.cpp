@@ -0,0 +1,645 @@
+#include "linq.h"
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <sstream>
+
+using namespace std;
+using namespace pl::linq;
+
+/*
+ * compares linq.h pipelines with hand-written loops doing the same work.
+ * usage: mqLinqBench [--sizes 1000,100000] [--filter where] [--min-time 100] [--out result.json]
+ * every (benchmark, value type, size) becomes one JSON record with the best time,
+ * the allocations of one run and whether both sides computed the same checksum.
+ */
+
+//////////////////////////////////////////////////////////////////
+// allocation counting
+//////////////////////////////////////////////////////////////////
+
+static std::size_t allocations = 0;
+
+//gcc 11 and later cannot tell that these replace the global allocation functions
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+    allocations++;
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+//std::stable_sort asks for its buffer through the nothrow form
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    allocations++;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+//////////////////////////////////////////////////////////////////
+// value types
+//////////////////////////////////////////////////////////////////
+
+struct small_pod
+{
+    int id;
+    int group;
+    double weight;
+};
+
+struct named_record
+{
+    string name;
+    int id;
+    int group;
+};
+
+template <class T>
+struct value_traits;
+
+template <>
+struct value_traits<int>
+{
+    static const char* name() { return "int"; }
+    static int make(int id) { return id; }
+    static int key(int x) { return x; }
+    static double weight(int x) { return x; }
+};
+
+template <>
+struct value_traits<double>
+{
+    static const char* name() { return "double"; }
+    static double make(int id) { return id + 0.5; }
+    static int key(double x) { return static_cast<int>(x); }
+    static double weight(double x) { return x; }
+};
+
+template <>
+struct value_traits<small_pod>
+{
+    static const char* name() { return "small_pod"; }
+    static small_pod make(int id) { return {id, id % 64, id * 0.5}; }
+    static int key(const small_pod& x) { return x.id; }
+    static double weight(const small_pod& x) { return x.weight; }
+};
+
+template <>
+struct value_traits<named_record>
+{
+    static const char* name() { return "named_record"; }
+    static named_record make(int id) { return {"record_" + to_string(id), id, id % 64}; }
+    static int key(const named_record& x) { return x.id; }
+    static double weight(const named_record& x) { return static_cast<double>(x.name.size()); }
+};
+
+//a fixed permutation of [first, first + n), so every run sorts and hashes the same input
+vector<int> shuffled_ids(std::size_t n, int first, unsigned seed)
+{
+    vector<int> ids(n);
+    for (std::size_t i = 0; i < n; i++)
+    {
+        ids[i] = first + static_cast<int>(i);
+    }
+    for (std::size_t i = n; i > 1; i--)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        swap(ids[i - 1], ids[seed % i]);
+    }
+    return ids;
+}
+
+template <class T>
+vector<T> make_values(const vector<int>& ids)
+{
+    vector<T> res;
+    res.reserve(ids.size());
+    for (int id : ids)
+    {
+        res.push_back(value_traits<T>::make(id));
+    }
+    return res;
+}
+
+//////////////////////////////////////////////////////////////////
+// runner
+//////////////////////////////////////////////////////////////////
+
+struct options
+{
+    vector<std::size_t> sizes = {1000, 100000};
+    string filter;
+    double min_time_ms = 100;
+    string out;
+};
+
+struct measurement
+{
+    double checksum;
+    double best_ns;
+    std::size_t runs;
+    std::size_t allocations;
+};
+
+struct result
+{
+    string name;
+    string type;
+    std::size_t size;
+    measurement linq;
+    measurement loop;
+    bool matches;
+};
+
+//keeps the optimizer from dropping the measured work
+volatile double sink = 0;
+
+class runner
+{
+private:
+    const options& _opts;
+    vector<result> _results;
+
+    template <class TFunction>
+    measurement measure(const TFunction& f) const
+    {
+        //the untimed first run warms caches and counts allocations
+        measurement m;
+        auto before = allocations;
+        m.checksum = f();
+        m.allocations = allocations - before;
+        m.best_ns = numeric_limits<double>::max();
+        m.runs = 0;
+
+        double total_ns = 0;
+        while (m.runs < 3 || (total_ns < budget_ns() && m.runs < 1000000))
+        {
+            auto start = chrono::steady_clock::now();
+            sink = sink + f();
+            double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+            m.best_ns = min(m.best_ns, ns);
+            total_ns += ns;
+            m.runs++;
+        }
+        return m;
+    }
+
+    double budget_ns() const
+    {
+        return _opts.min_time_ms * 1e6;
+    }
+
+    static bool same_checksum(double a, double b)
+    {
+        //both sides may add floating point values in a different order
+        return std::abs(a - b) <= 1e-9 * max(1.0, max(std::abs(a), std::abs(b)));
+    }
+
+    static string escape(const string& s)
+    {
+        string res;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                res += '\\';
+            }
+            res += c;
+        }
+        return res;
+    }
+
+public:
+    explicit runner(const options& opts)
+        : _opts(opts)
+    {
+    }
+
+    template <class TLinq, class TLoop>
+    void run(const string& name, const char* type, std::size_t size, const TLinq& linq_body, const TLoop& loop_body)
+    {
+        if ((name + "/" + type).find(_opts.filter) == string::npos)
+        {
+            return;
+        }
+        result r{name, type, size, measure(linq_body), measure(loop_body), false};
+        r.matches = same_checksum(r.linq.checksum, r.loop.checksum);
+        cerr << name << "/" << type << "/" << size << ": "
+            << r.linq.best_ns / r.loop.best_ns << "x" << (r.matches ? "" : " CHECKSUM MISMATCH") << endl;
+        _results.push_back(r);
+    }
+
+    bool all_matched() const
+    {
+        return from(_results).all([](const result& r) { return r.matches; });
+    }
+
+    void write_json(ostream& out) const
+    {
+        out << "{\n  \"min_time_ms\": " << _opts.min_time_ms << ",\n  \"benchmarks\": [";
+        for (std::size_t i = 0; i < _results.size(); i++)
+        {
+            const auto& r = _results[i];
+            out << (i == 0 ? "\n" : ",\n")
+                << "    {\"name\": \"" << escape(r.name) << "\", \"type\": \"" << escape(r.type) << "\", \"size\": " << r.size
+                << ", \"linq_ns\": " << r.linq.best_ns << ", \"loop_ns\": " << r.loop.best_ns
+                << ", \"ratio\": " << r.linq.best_ns / r.loop.best_ns
+                << ", \"linq_runs\": " << r.linq.runs << ", \"loop_runs\": " << r.loop.runs
+                << ", \"linq_allocations\": " << r.linq.allocations << ", \"loop_allocations\": " << r.loop.allocations
+                << ", \"matches\": " << (r.matches ? "true" : "false") << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+};
+
+//////////////////////////////////////////////////////////////////
+// benchmarks
+//////////////////////////////////////////////////////////////////
+
+template <class T>
+void run_value_type(runner& r, std::size_t n)
+{
+    using traits = value_traits<T>;
+    const char* type = traits::name();
+
+    //ys overlaps the second half of xs, so joins and set operators find n / 2 matches
+    const vector<T> xs = make_values<T>(shuffled_ids(n, 0, 1));
+    const vector<T> ys = make_values<T>(shuffled_ids(n, static_cast<int>(n / 2), 2));
+    vector<vector<T>> chunks;
+    for (std::size_t i = 0; i < n; i += 16)
+    {
+        chunks.emplace_back(xs.begin() + i, xs.begin() + min(n, i + 16));
+    }
+
+    auto key = [](const T& x) { return traits::key(x); };
+    auto group = [](const T& x) { return traits::key(x) % 64; };
+    auto weight = [](const T& x) { return traits::weight(x); };
+    auto even = [](const T& x) { return traits::key(x) % 2 == 0; };
+
+    //////////////////////////////////////////////////////////////////
+    // select and where
+    //////////////////////////////////////////////////////////////////
+    r.run("where_select", type, n, [&]()
+        {
+            return from(xs).where(even).select([](const T& x) { return traits::weight(x) * 2; }).sum();
+        }, [&]()
+        {
+            double s = 0;
+            for (const auto& x : xs)
+            {
+                if (traits::key(x) % 2 == 0)
+                {
+                    s += traits::weight(x) * 2;
+                }
+            }
+            return s;
+        });
+
+    r.run("erased", type, n, [&]()
+        {
+            linq<double> hidden = from(xs).where(even).select(weight);
+            return hidden.sum();
+        }, [&]()
+        {
+            double s = 0;
+            for (const auto& x : xs)
+            {
+                if (traits::key(x) % 2 == 0)
+                {
+                    s += traits::weight(x);
+                }
+            }
+            return s;
+        });
+
+    r.run("select_many", type, n, [&]()
+        {
+            return from(chunks).select_many([](const vector<T>& c) { return from(c); }).select(weight).sum();
+        }, [&]()
+        {
+            double s = 0;
+            for (const auto& c : chunks)
+            {
+                for (const auto& x : c)
+                {
+                    s += traits::weight(x);
+                }
+            }
+            return s;
+        });
+
+    //////////////////////////////////////////////////////////////////
+    // ordering
+    //////////////////////////////////////////////////////////////////
+    r.run("order_by", type, n, [&]()
+        {
+            auto sorted = from(xs).order_by(key).to_vector();
+            double s = 0;
+            for (std::size_t i = 0; i < sorted.size(); i++)
+            {
+                s += traits::key(sorted[i]) * static_cast<double>(i % 8);
+            }
+            return s;
+        }, [&]()
+        {
+            auto sorted = xs;
+            stable_sort(sorted.begin(), sorted.end(), [](const T& a, const T& b) { return traits::key(a) < traits::key(b); });
+            double s = 0;
+            for (std::size_t i = 0; i < sorted.size(); i++)
+            {
+                s += traits::key(sorted[i]) * static_cast<double>(i % 8);
+            }
+            return s;
+        });
+
+    r.run("order_by_take", type, n, [&]()
+        {
+            return from(xs).order_by(key).take(10).select(weight).sum();
+        }, [&]()
+        {
+            vector<T> smallest(min<std::size_t>(10, n), xs.front());
+            partial_sort_copy(xs.begin(), xs.end(), smallest.begin(), smallest.end(), [](const T& a, const T& b) { return traits::key(a) < traits::key(b); });
+            double s = 0;
+            for (const auto& x : smallest)
+            {
+                s += traits::weight(x);
+            }
+            return s;
+        });
+
+    //////////////////////////////////////////////////////////////////
+    // restructuring
+    //////////////////////////////////////////////////////////////////
+    r.run("group_by", type, n, [&]()
+        {
+            return from(xs).group_by(group).aggregate(0.0, [](double s, const pair<int, linq<T>>& g)
+                {
+                    return s + g.first * static_cast<double>(g.second.count());
+                });
+        }, [&]()
+        {
+            unordered_map<int, vector<T>> groups;
+            for (const auto& x : xs)
+            {
+                groups[traits::key(x) % 64].push_back(x);
+            }
+            double s = 0;
+            for (const auto& g : groups)
+            {
+                s += g.first * static_cast<double>(g.second.size());
+            }
+            return s;
+        });
+
+    //////////////////////////////////////////////////////////////////
+    // joining
+    //////////////////////////////////////////////////////////////////
+    r.run("join", type, n, [&]()
+        {
+            return from(xs).join(ys, key, key).aggregate(0.0, [](double s, const tuple<int, T, T>& t)
+                {
+                    return s + traits::weight(get<1>(t)) + traits::weight(get<2>(t));
+                });
+        }, [&]()
+        {
+            unordered_map<int, vector<const T*>> table;
+            for (const auto& y : ys)
+            {
+                table[traits::key(y)].push_back(&y);
+            }
+            double s = 0;
+            for (const auto& x : xs)
+            {
+                auto it = table.find(traits::key(x));
+                if (it != table.end())
+                {
+                    for (auto y : it->second)
+                    {
+                        s += traits::weight(x) + traits::weight(*y);
+                    }
+                }
+            }
+            return s;
+        });
+
+    r.run("full_join", type, n, [&]()
+        {
+            return from(xs).full_join(ys, key, key).aggregate(0.0, [](double s, const tuple<int, linq<T>, linq<T>>& t)
+                {
+                    return s + get<0>(t) * static_cast<double>(get<1>(t).count() + 2 * get<2>(t).count());
+                });
+        }, [&]()
+        {
+            unordered_map<int, pair<vector<T>, vector<T>>> groups;
+            for (const auto& x : xs)
+            {
+                groups[traits::key(x)].first.push_back(x);
+            }
+            for (const auto& y : ys)
+            {
+                groups[traits::key(y)].second.push_back(y);
+            }
+            double s = 0;
+            for (const auto& g : groups)
+            {
+                s += g.first * static_cast<double>(g.second.first.size() + 2 * g.second.second.size());
+            }
+            return s;
+        });
+
+    //////////////////////////////////////////////////////////////////
+    // set
+    //////////////////////////////////////////////////////////////////
+    r.run("distinct_by", type, n, [&]()
+        {
+            return from(xs).distinct_by([](const T& x) { return traits::key(x) / 2; }).select(weight).sum();
+        }, [&]()
+        {
+            unordered_set<int> seen;
+            double s = 0;
+            for (const auto& x : xs)
+            {
+                if (seen.insert(traits::key(x) / 2).second)
+                {
+                    s += traits::weight(x);
+                }
+            }
+            return s;
+        });
+
+    r.run("intersect_with", type, n, [&]()
+        {
+            return static_cast<double>(from(xs).select(key).intersect_with(from(ys).select(key)).count());
+        }, [&]()
+        {
+            unordered_set<int> other;
+            for (const auto& y : ys)
+            {
+                other.insert(traits::key(y));
+            }
+            unordered_set<int> seen;
+            double c = 0;
+            for (const auto& x : xs)
+            {
+                if (other.count(traits::key(x)) && seen.insert(traits::key(x)).second)
+                {
+                    c++;
+                }
+            }
+            return c;
+        });
+
+    r.run("union_with", type, n, [&]()
+        {
+            return static_cast<double>(from(xs).select(key).union_with(from(ys).select(key)).count());
+        }, [&]()
+        {
+            unordered_set<int> seen;
+            for (const auto& x : xs)
+            {
+                seen.insert(traits::key(x));
+            }
+            for (const auto& y : ys)
+            {
+                seen.insert(traits::key(y));
+            }
+            return static_cast<double>(seen.size());
+        });
+
+    //////////////////////////////////////////////////////////////////
+    // containers
+    //////////////////////////////////////////////////////////////////
+    r.run("to_vector", type, n, [&]()
+        {
+            return static_cast<double>(from(xs).where(even).to_vector().size());
+        }, [&]()
+        {
+            vector<T> res;
+            for (const auto& x : xs)
+            {
+                if (traits::key(x) % 2 == 0)
+                {
+                    res.push_back(x);
+                }
+            }
+            return static_cast<double>(res.size());
+        });
+
+    r.run("to_unordered_map", type, n, [&]()
+        {
+            return static_cast<double>(from(xs).to_unordered_map(key).size());
+        }, [&]()
+        {
+            unordered_map<int, T> res;
+            for (const auto& x : xs)
+            {
+                res.emplace(traits::key(x), x);
+            }
+            return static_cast<double>(res.size());
+        });
+}
+
+bool parse_options(int argc, char* argv[], options& opts)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (i + 1 == argc)
+        {
+            cerr << "missing value for " << arg << endl;
+            return false;
+        }
+        string value = argv[++i];
+        if (arg == "--sizes")
+        {
+            opts.sizes.clear();
+            stringstream ss(value);
+            string item;
+            while (getline(ss, item, ','))
+            {
+                opts.sizes.push_back(static_cast<std::size_t>(stoull(item)));
+            }
+        }
+        else if (arg == "--filter")
+        {
+            opts.filter = value;
+        }
+        else if (arg == "--min-time")
+        {
+            opts.min_time_ms = stod(value);
+        }
+        else if (arg == "--out")
+        {
+            opts.out = value;
+        }
+        else
+        {
+            cerr << "unknown option " << arg << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    if (!parse_options(argc, argv, opts))
+    {
+        cerr << "usage: mqLinqBench [--sizes 1000,100000] [--filter where] [--min-time 100] [--out result.json]" << endl;
+        return 2;
+    }
+
+    runner r(opts);
+    for (auto n : opts.sizes)
+    {
+        if (n == 0)
+        {
+            continue;
+        }
+        run_value_type<int>(r, n);
+        run_value_type<double>(r, n);
+        run_value_type<small_pod>(r, n);
+        run_value_type<named_record>(r, n);
+    }
+
+    if (opts.out.empty())
+    {
+        r.write_json(cout);
+    }
+    else
+    {
+        ofstream out(opts.out);
+        r.write_json(out);
+    }
+    return r.all_matched() ? 0 : 1;
+}